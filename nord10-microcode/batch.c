@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2024 Anders Magnusson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Batch runner: run the jobs of a manifest on a pool of threads,
+ * one machine per job, and report how each one went.
+ *
+ * A manifest line is
+ *	tape input budget expected
+ * with - for a file that is not used.  tape is attached to the paper
+ * tape reader, input is fed to the console first (as with -i), budget
+ * is the number of instructions to run and expected is the console
+ * output the job must produce to pass.  # starts a comment.
+ *
+ * A job ends when it has run its budget, or when the guest has gone
+ * back to the console (no instructions fetched for IDLESTEPS steps).
+ *
+ * Each thread owns a range of the jobs and takes them from the front;
+ * when its own range is empty it steals from the back of another.
+ */
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nd10.h"
+
+#define	CHUNK		100000		/* micro-steps between checks */
+#define	IDLESTEPS	1000000		/* halted if idle this long */
+#define	MAXSTEPS	100000000L	/* never started */
+
+struct job {
+	int line;
+	char *tape, *input, *expected;
+	long budget;
+
+	int pass;
+	long insns;
+	double secs;
+	char *why;
+	char msg[200];		/* why, when the machine failed */
+};
+
+struct queue {
+	pthread_mutex_t lock;
+	int lo, hi;		/* jobs not yet taken */
+};
+
+static struct job *jobs;
+static int njobs;
+static struct queue *qs;
+static int nqs;
+static char *prom, *ename;
+static int psize, nat;
+
+static char *
+field(char *s)
+{
+	return strcmp(s, "-") == 0 ? NULL : strdup(s);
+}
+
+static void
+readmanifest(char *file)
+{
+	FILE *fp;
+	char buf[1024], t[256], i[256], b[64], e[256], *s;
+	int line = 0, maxjobs = 0;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		line++;
+		if ((s = strchr(buf, '#')) != NULL)
+			*s = 0;
+		if (sscanf(buf, "%255s", t) != 1)
+			continue;
+		if (sscanf(buf, "%255s %255s %63s %255s", t, i, b, e) != 4)
+			errx(1, "%s:%d: need tape input budget expected",
+			    file, line);
+		if (njobs == maxjobs) {
+			maxjobs = maxjobs ? maxjobs * 2 : 64;
+			if ((jobs = realloc(jobs,
+			    maxjobs * sizeof(struct job))) == NULL)
+				err(1, "realloc");
+		}
+		memset(&jobs[njobs], 0, sizeof(struct job));
+		jobs[njobs].line = line;
+		jobs[njobs].tape = field(t);
+		jobs[njobs].input = field(i);
+		jobs[njobs].expected = field(e);
+		if ((jobs[njobs].budget = strtol(b, &s, 0)) <= 0 || *s)
+			errx(1, "%s:%d: bad budget %s", file, line, b);
+		njobs++;
+	}
+	fclose(fp);
+}
+
+/* the whole expected file, or NULL */
+static char *
+slurp(char *file, size_t *len)
+{
+	FILE *fp;
+	char *s;
+	long n;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	rewind(fp);
+	if ((s = malloc(n + 1)) == NULL || fread(s, 1, n, fp) != (size_t)n) {
+		fclose(fp);
+		free(s);
+		return NULL;
+	}
+	fclose(fp);
+	*len = n;
+	return s;
+}
+
+static void
+runjob(struct job *j)
+{
+	struct timespec t0, t1;
+	struct nd10 *c = NULL;
+	FILE *in = NULL, *out = NULL;
+	char *obuf = NULL, *ebuf = NULL;
+	size_t olen = 0, elen = 0;
+	long steps, idle, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	j->why = "output differs";
+	if (j->tape && access(j->tape, R_OK) < 0) {
+		j->why = "cannot read tape";
+		goto out;
+	}
+	if (j->input && (in = fopen(j->input, "r")) == NULL) {
+		j->why = "cannot read input";
+		goto out;
+	}
+	if (j->expected && (ebuf = slurp(j->expected, &elen)) == NULL) {
+		j->why = "cannot read expected output";
+		goto out;
+	}
+	if ((out = open_memstream(&obuf, &olen)) == NULL ||
+	    (c = nd10_create()) == NULL) {
+		j->why = "out of memory";
+		goto out;
+	}
+	if (nd10_loadprom(c, prom, psize) < 0) {
+		j->why = "cannot read prom";
+		goto out;
+	}
+	nd10_setengine(c, ename);
+	nd10_setnative(c, nat);
+	nd10_settape(c, j->tape);
+	nd10_setio(c, in, out);	/* in is closed at its end */
+	in = NULL;
+
+	for (steps = idle = 0; j->insns < j->budget; steps += CHUNK) {
+		if ((n = nd10_run(c, CHUNK, j->budget - j->insns)) < 0) {
+			snprintf(j->msg, sizeof(j->msg), "%s", nd10_error(c));
+			j->why = j->msg;
+			goto out;
+		}
+		if (n == 0)
+			idle += CHUNK;
+		else
+			idle = 0;
+		j->insns = nd10_icount(c);
+		if (idle >= IDLESTEPS && (j->insns || steps >= MAXSTEPS))
+			break;
+	}
+	nd10_destroy(c);
+	c = NULL;
+	fclose(out);
+	out = NULL;
+	if (j->expected == NULL ||
+	    (olen == elen && memcmp(obuf, ebuf, olen) == 0)) {
+		j->pass = 1;
+		j->why = "";
+	}
+out:	if (c)
+		nd10_destroy(c);
+	if (out)
+		fclose(out);
+	if (in)
+		fclose(in);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	j->secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	free(obuf);
+	free(ebuf);
+}
+
+/* next job for thread q: its own first, else the last of another */
+static struct job *
+getjob(int q)
+{
+	struct queue *p;
+	int i, n = -1;
+
+	for (i = 0; i < nqs && n < 0; i++) {
+		p = &qs[(q + i) % nqs];
+		pthread_mutex_lock(&p->lock);
+		if (p->lo < p->hi)
+			n = i == 0 ? p->lo++ : --p->hi;
+		pthread_mutex_unlock(&p->lock);
+	}
+	return n < 0 ? NULL : &jobs[n];
+}
+
+static void *
+worker(void *arg)
+{
+	struct job *j;
+
+	while ((j = getjob((int)(long)arg)) != NULL)
+		runjob(j);
+	return NULL;
+}
+
+/*
+ * Run the manifest with nthreads threads (0 for one per cpu) and
+ * print one line per job.  native is as for nd10_setnative().
+ * Returns the number of failed jobs.
+ */
+int
+nd10_batch(char *manifest, char *promfile, int words, char *engname,
+    int native, int nthreads)
+{
+	struct timespec t0, t1;
+	pthread_t *tids;
+	int i, nfail = 0;
+	long insns = 0;
+	double s;
+
+	prom = promfile;
+	psize = words;
+	ename = engname;
+	nat = native;
+	readmanifest(manifest);
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > njobs)
+		nthreads = njobs;
+	if (nthreads <= 0)
+		nthreads = 1;
+	nqs = nthreads;
+	if ((qs = calloc(nqs, sizeof(struct queue))) == NULL ||
+	    (tids = calloc(nqs, sizeof(pthread_t))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nqs; i++) {
+		pthread_mutex_init(&qs[i].lock, NULL);
+		qs[i].lo = njobs * i / nqs;
+		qs[i].hi = njobs * (i + 1) / nqs;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nqs; i++)
+		if (pthread_create(&tids[i], NULL, worker, (void *)(long)i))
+			errx(1, "pthread_create");
+	for (i = 0; i < nqs; i++)
+		pthread_join(tids[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for (i = 0; i < njobs; i++) {
+		struct job *j = &jobs[i];
+
+		printf("%s:%d: %s %ld insns %.3fs %s\n", manifest, j->line,
+		    j->pass ? "pass" : "FAIL", j->insns, j->secs, j->why);
+		nfail += !j->pass;
+		insns += j->insns;
+	}
+	s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%d jobs, %d failed, %ld insns in %.3fs on %d threads\n",
+	    njobs, nfail, insns, s, nqs);
+	return nfail;
+}
@@ -210,4 +210,5 @@ p(char *s)
 void
 parsear(int l)
 {
+	(void)l;
 }
@@ -27,22 +27,28 @@
  * Nord-10 Entry Point Generator (based on schematics on board 1075).
  * Input is IR (+ old MIR).
  * Output is MPC.
+ *
+ * The emulator does not evaluate the gates on each fetch; epginit()
+ * builds epgtab[] once from them.  Only IR bits 6-15 are inputs to
+ * the network (with MIR 0), so the table is indexed by IR >> 6.
  */
 
 #include "stdio.h"
 #include "bits.h"
+#include "epg.h"
 
 int sn7464(int a1, int a2, int a3, int a4);
 int sn7411(int a1, int a2, int a3);
 int sn7410(int a1, int a2, int a3);
 int sn7400(int a1, int a2);
 
+unsigned short epgtab[EPGTABSZ];
+
 int
 epg(int ir, int mir)
 {
 	int ir_n = ~ir;
 	int mir_n = ~mir;
-	int car = ir;
 	int car_n = ~ir;
 
 	int epc;
@@ -102,6 +108,37 @@ epg(int ir, int mir)
 	return epc;
 }
 
+/*
+ * Fill in the entry point table from the gate network.
+ */
+void
+epginit(void)
+{
+	int i;
+
+	for (i = 0; i < EPGTABSZ; i++)
+		epgtab[i] = epg(i << EPGSHIFT, 0);
+}
+
+/*
+ * Check the table against the gates for all IR values.
+ * Returns the number of mismatches.
+ */
+int
+epgverify(void)
+{
+	int ir, n = 0;
+
+	for (ir = 0; ir < 0200000; ir++) {
+		if (EPG(ir) != epg(ir, 0)) {
+			printf("IR %06o: table %04o gates %04o\n",
+			    ir, EPG(ir), epg(ir, 0));
+			n++;
+		}
+	}
+	return n;
+}
+
 int
 sn7400(int a, int b)
 {
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2024 Anders Magnusson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Test of the native instructions (-n) against the microcode.
+ *
+ * Builds a guest program of cases, each one instruction with the
+ * addressing modes and register operands that the native handlers
+ * know, and runs it in lockstep (-LL) so that every native instruction
+ * is checked against the microcode.  Before each case a subroutine
+ * loads the registers and STS from a table of random records, after
+ * it another one folds them into a sum, which the guest prints at
+ * the end; the microcode, native and lockstep runs must print the
+ * same.
+ *
+ * A second program tests paging: a protect violation and a page fault
+ * taken to level 14, whose handler maps the page, and a remap through
+ * the shadow page table that must flush the old translation.  The
+ * tables are written with paging off, so the native stores must go to
+ * the shadow table too.  Run again without the page fault enabled it
+ * must stop at the fault.
+ *
+ * Usage: natest [prom.hex]
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nd10.h"
+
+#define	CODE	001000		/* the cases, subroutines before */
+#define	RECS	040000		/* register records, 8 words each */
+#define	NRECS	0400
+#define	W	050000		/* B points here; pointers just below */
+#define	ROUNDS	4		/* times through the cases */
+
+#define	CHUNK	100000		/* micro-steps between checks */
+#define	IDLE	1000000		/* back at the console if idle this long */
+#define	MAXSTEPS 100000000L
+
+/* memory reference instructions */
+#define	STZ	0000000
+#define	STA	0004000
+#define	STD	0020000
+#define	LDD	0024000
+#define	STF	0030000
+#define	LDF	0034000
+#define	MIN	0040000
+#define	LDA	0044000
+#define	ADD	0060000
+#define	AND	0070000
+#define	JMP	0124000
+#define	JPL	0134000
+#define	MX	02000		/* ,X */
+#define	MI	01000		/* I */
+#define	MB	00400		/* ,B */
+
+#define	IIE_PV	04		/* internal interrupts enabled */
+#define	IIE_PF	010
+
+#define	AAA1	0172401		/* filler after a skip */
+#define	EXIT	0146142
+#define	IOXTTY	0164305
+#define	WAIT	0151000
+
+static unsigned short img[65536];
+static int pc, setup, fold, nsum, ncases;
+
+static unsigned
+rnd(void)
+{
+	static unsigned long x = 1;
+
+	x = x * 6364136223846793005UL + 1442695040888963407UL;
+	return x >> 33;
+}
+
+static void
+emit(int w)
+{
+	img[pc++] = w;
+}
+
+/* P relative memory reference to addr */
+static void
+mref(int op, int addr)
+{
+	int d = addr - pc;
+
+	if (d < -128 || d > 127)
+		errx(1, "displacement %d at %o", d, pc);
+	emit(op | (d & 0377));
+}
+
+/* Start a case: JPL to setup, come back over the pointer. */
+static void
+casebeg(void)
+{
+	emit(JPL | MI | 2);
+	emit(JMP | 2);
+	emit(setup);
+	ncases++;
+}
+
+static void
+caseend(void)
+{
+	emit(JPL | MI | 2);
+	emit(JMP | 2);
+	emit(fold);
+}
+
+/* A case of one instruction, and a filler if it may skip. */
+static void
+one(int w, int skips)
+{
+	casebeg();
+	emit(w);
+	if (skips)
+		emit(AAA1);
+	caseend();
+}
+
+/*
+ * Memory references in all the modes, n words of operand.  Stores
+ * stay in W..W+0137 and low memory; the pointers below W are only read.
+ */
+static void
+memref(int op, int n, int skips)
+{
+	int i;
+
+	one(op | MB | 1, skips);
+	one(op | MB | 5, skips);
+	one(op | MB | MX | 2, skips);
+	one(op | MX | 3, skips);
+	one(op | MB | MI | 0371, skips);
+	one(op | MB | MI | MX | 0372, skips);
+	if (skips)
+		return;
+	casebeg();			// P relative, indirect
+	emit(op | MI | 2);
+	emit(JMP | 2);
+	emit(W + 0100 + (rnd() & 037));
+	caseend();
+	casebeg();
+	emit(op | MI | MX | 2);
+	emit(JMP | 2);
+	emit(W + 0100 + (rnd() & 017));
+	caseend();
+	casebeg();			// P relative
+	emit(op | 2);
+	emit(JMP | (n + 1));
+	for (i = 0; i < n; i++)
+		emit(rnd() & 0177777);
+	caseend();
+}
+
+/*
+ * Registers from the next record: A, D, T, X, -, STS.  Sets B to W.
+ */
+static void
+mksetup(void)
+{
+	int rp = pc + 13;
+
+	setup = pc;
+	mref(LDA, rp + 2);		// B = W
+	emit(0146153);			// COPY SA DB
+	mref(LDA, rp);			// X = record, to the next one
+	emit(0146157);			// COPY SA DX
+	emit(0172410);			// AAA 10
+	mref(AND, rp + 1);
+	mref(STA, rp);
+	emit(LDA | MX | 5);		// STS
+	emit(0150101);			// TRR STS
+	emit(LDD | MX | 0);
+	emit(0052002);			// LDT 2,X
+	emit(0056003);			// LDX 3,X
+	emit(EXIT);
+	if (pc != rp)
+		errx(1, "setup");
+	emit(RECS);
+	emit(RECS + NRECS * 8 - 1);
+	emit(W);
+}
+
+/* sum = sum rotated + A + D + T + X + B + STS */
+static void
+mkfold(void)
+{
+	int f = pc + 18;
+
+	fold = pc;
+	mref(STD, f);
+	mref(STA + 010000, f + 2);	// STT
+	mref(STA + 014000, f + 3);	// STX
+	emit(0146135);			// COPY SB DA
+	mref(STA, f + 4);
+	emit(0150001);			// TRA STS
+	mref(STA, f + 5);
+	mref(LDA, f + 6);
+	emit(0155401);			// SHA ROT 1
+	mref(ADD, f);
+	mref(ADD, f + 1);
+	mref(ADD, f + 2);
+	mref(ADD, f + 3);
+	mref(ADD, f + 4);
+	mref(ADD, f + 5);
+	mref(STA, f + 6);
+	emit(EXIT);
+	emit(0);			// pad
+	if (pc != f)
+		errx(1, "fold");
+	pc += 7;
+	nsum = f + 6;
+}
+
+/* Print the sum in octal and halt. */
+static void
+mkprint(void)
+{
+	int i;
+
+	mref(LDA, nsum);
+	emit(0146151);			// COPY SA DD
+	emit(0170400);			// SAA 0
+	emit(0154601);			// SAD SHL 1
+	emit(0172460);			// AAA 60
+	emit(IOXTTY);
+	for (i = 0; i < 5; i++) {
+		emit(0170400);
+		emit(0154603);		// SAD SHL 3
+		emit(0172460);
+		emit(IOXTTY);
+	}
+	emit(0170415);			// SAA 15
+	emit(IOXTTY);
+	emit(0170412);			// SAA 12
+	emit(IOXTTY);
+	emit(WAIT);
+}
+
+static void
+mkprog(void)
+{
+	static const int mr[] = { STZ, 0004000, 0010000, 0014000,
+	    MIN, LDA, 0050000, 0054000, ADD, 0064000, AND, 0074000 };
+	static const int rops[] = { 0144000, 0144100, 0144200, 0144300,
+	    0144400, 0144500, 0144600, 0144700, 0145000, 0145100,
+	    0145400, 0145500 };		// SWAP, RAND, REXO, RORA
+	static const int pairs[][2] = { { 5, 6 }, { 1, 7 }, { 3, 4 },
+	    { 0, 5 }, { 2, 1 }, { 7, 3 } };
+	static const int counts[] = { 1, 5, 15, 16, 037, 077, 070, 060, 041 };
+	static const int args[] = { 0, 1, 0177, 0200, 0377 };
+	static const int bregs[] = { 1, 3, 4, 5, 6, 7 };
+	int i, j, k, start, print;
+
+	pc = 0100;
+	emit(JMP | MI | 1);		// the console starts here
+	emit(CODE);
+	pc = 0200;
+	mksetup();
+	mkfold();
+	print = pc;
+	mkprint();
+	if (pc > CODE)
+		errx(1, "subroutines too big");
+
+	pc = CODE;
+	start = pc;
+	for (i = 0; i < (int)(sizeof(mr)/sizeof(mr[0])); i++)
+		memref(mr[i], 1, mr[i] == MIN);
+	memref(STD, 2, 0);
+	memref(LDD, 2, 0);
+	memref(STF, 3, 0);
+	memref(LDF, 3, 0);
+
+	one(JMP | 1, 0);
+	one(JPL | 1, 0);
+	casebeg();
+	emit(JMP | MI | 1);
+	emit(pc + 1);
+	caseend();
+
+	for (i = 0; i < 8; i++)		// JAP .. JXN
+		one(0130000 | i << 8 | 2, 1);
+	for (i = 0; i < 8; i++)		// SKP
+		for (j = 0; j < 6; j++)
+			one(0140000 | i << 8 | pairs[j][0] << 3 |
+			    (pairs[j][1] == 2 ? 1 : pairs[j][1]), 1);
+
+	for (i = 0; i < 020; i++)	// RADD, RSUB, COPY ...
+		for (j = 0; j < 6; j++)
+			if (pairs[j][1] != 2)
+				one(0146000 | i << 6 | pairs[j][0] << 3 |
+				    pairs[j][1], 0);
+	for (i = 0; i < (int)(sizeof(rops)/sizeof(rops[0])); i++)
+		for (j = 0; j < 6; j++)
+			if (pairs[j][0] != 2 && pairs[j][1] != 2)
+				one(rops[i] | pairs[j][0] << 3 | pairs[j][1], 0);
+
+	for (i = 0; i < 4; i++)		// SHT, SHD, SHA, SAD
+		for (j = 0; j < 4; j++)
+			for (k = 0; k < (int)(sizeof(counts)/sizeof(counts[0])); k++)
+				one(0154000 | j << 9 | i << 7 | counts[k], 0);
+
+	for (i = 0; i < 8; i++)		// SAB .. AAX
+		for (j = 0; j < (int)(sizeof(args)/sizeof(args[0])); j++)
+			one(0170000 | i << 8 | args[j], 0);
+
+	for (i = 0; i < 020; i++) {	// BSET .. BORA
+		for (j = 0; j < 6; j++) {
+			one(0174000 | i << 7 | 0 << 3 | bregs[j], 1);
+			one(0174000 | i << 7 | 7 << 3 | bregs[j], 1);
+			one(0174000 | i << 7 | 010 << 3 | bregs[j], 1);
+			one(0174000 | i << 7 | 017 << 3 | bregs[j], 1);
+		}
+		for (k = 2; k < 8; k++)		// STS: K Z Q O C M
+			one(0174000 | i << 7 | k << 3, 1);
+	}
+
+	for (i = 1; i < 016; i++)	// TRA
+		if (i != 014)
+			one(0150000 | i, 0);
+	for (i = 0; i < 010; i++)	// TRR, but not PVL
+		if (i != 4)
+			one(0150100 | i, 0);
+	for (i = 1; i < 010; i++)	// MCL, MST
+		if (i != 4) {
+			one(0150200 | i, 0);
+			one(0150300 | i, 0);
+		}
+
+	casebeg();			// byte to and from W
+	emit(0146136);			// COPY SB DT
+	emit(0142600);			// SBYT
+	emit(0142200);			// LBYT
+	caseend();
+	one(0143200, 0);		// MIX3
+
+	emit(MIN | 4);
+	emit(JMP | MI | 2);
+	emit(JMP | 3);
+	emit(start);
+	emit(-ROUNDS & 0177777);
+	emit(JMP | MI | 1);
+	emit(print);
+	if (pc > RECS)
+		errx(1, "program too big");
+
+	for (i = 0; i < NRECS; i++) {
+		for (j = 0; j < 8; j++)
+			img[RECS + i*8 + j] = rnd() & 0177777;
+		img[RECS + i*8 + 3] &= 017;	// X
+		img[RECS + i*8 + 5] &= 0374;	// STS
+	}
+	for (i = 0; i < 8; i++)
+		img[W - 8 + i] = W + 040 + (rnd() & 037);
+	for (i = 0; i < 0200; i++)
+		img[W + i] = rnd() & 0177777;
+}
+
+/*
+ * The paging program, in ring 3 on level 0 and 14 with page table 0:
+ * page 0 is memory page 0, page 1 reads page 2 and page 2 is missing.
+ * The level 14 handler prints the IIC code and maps the page from
+ * fix[], then returns to restart the instruction.  The main program
+ * prints what it reads, biased by 040.
+ */
+#define	PGK	0240		/* constants */
+#define	PGH	0300		/* the level 14 handler */
+#define	PGFIX	070		/* new entries, by page */
+
+enum { K_E0, K_E1, K_E1W, K_SHADOW, K_SH1, K_SH2, K_PCR0, K_PCR14,
+    K_H, K_PIE, K_IIE, K_V1, K_V2, K_R, K_077, K_N };
+
+static void
+mkpaging(int iiebits)
+{
+	static const int k[K_N] = { 0160000, 0040002, 0160002, 0177400,
+	    0177401, 0177402, 03, 0163, PGH, 040000, 0, 02000, 04000,
+	    'R' - 040, 077 };
+	int i;
+
+	memset(img, 0, sizeof(img));
+	for (i = 0; i < K_N; i++)
+		img[PGK + i] = k[i];
+	img[PGK + K_IIE] = iiebits;
+	img[PGFIX + 1] = 0160003;
+	img[PGFIX + 2] = 0160004;
+	img[02000 * 2] = 'P' - 040;
+	img[02000 * 3] = 'Q' - 040;
+	img[02000 * 4] = 'S' - 040;
+
+	pc = 0100;			// page table, interrupts, paging on
+	mref(LDA, PGK + K_E0);
+	mref(STA | MI, PGK + K_SHADOW);
+	mref(LDA, PGK + K_E1);
+	mref(STA | MI, PGK + K_SH1);
+	mref(STZ | MI, PGK + K_SH2);
+	mref(LDA, PGK + K_PCR0);
+	emit(0150103);			// TRR PCR
+	mref(LDA, PGK + K_PCR14);
+	emit(0150103);
+	mref(LDA, PGK + K_H);
+	emit(0153562);			// IRW 14 DP
+	mref(LDA, PGK + K_SHADOW);
+	emit(0153563);			// IRW 14 DB
+	mref(LDA, PGK + K_PIE);
+	emit(0150107);			// TRR PIE
+	mref(LDA, PGK + K_IIE);
+	emit(0150105);			// TRR IIE
+	emit(0150402);			// ION
+	emit(0150410);			// PON
+
+	mref(LDA | MI, PGK + K_V1);	// read only page
+	emit(0172440);			// AAA 40
+	emit(IOXTTY);
+	mref(LDA, PGK + K_R);		// PV, mapped to page 3
+	mref(STA | MI, PGK + K_V1);
+	mref(LDA | MI, PGK + K_V1);
+	emit(0172440);
+	emit(IOXTTY);
+	mref(LDA, PGK + K_E1W);		// back to page 2, flushes
+	mref(STA | MI, PGK + K_SH1);
+	mref(LDA | MI, PGK + K_V1);
+	emit(0172440);
+	emit(IOXTTY);
+	mref(LDA | MI, PGK + K_V2);	// PF, mapped to page 4
+	emit(0172440);
+	emit(IOXTTY);
+	emit(0150401);			// IOF
+	emit(WAIT);
+	if (pc > PGK)
+		errx(1, "paging program too big");
+
+	pc = PGH;
+	emit(0150005);			// TRA IIC
+	emit(0172460);			// AAA 60
+	emit(IOXTTY);
+	emit(0150003);			// TRA PGS
+	mref(AND, PGK + K_077);
+	emit(0146157);			// COPY SA DX
+	emit(LDA | MX | PGFIX);
+	emit(STA | MB | MX | 0);	// the shadow entry
+	emit(WAIT);
+	emit(JMP | (-(pc - PGH) & 0377));
+}
+
+static char *names[] = { "microcode", "native", "", "lockstep" };
+
+/* Run the program with native as for nd10_setnative(), into out. */
+static void
+run(char *prom, int native, char *out, size_t len)
+{
+	static char go[] = "100!";
+	struct nd10 *c;
+	FILE *in, *ofp;
+	long n, idle, steps;
+
+	if ((c = nd10_create()) == NULL)
+		err(1, "nd10_create");
+	if (nd10_loadprom(c, prom, 1024) < 0)
+		err(1, "%s", prom);
+	nd10_loadmem(c, 0, img, 65536);
+	nd10_setnative(c, native);
+	if ((in = fmemopen(go, strlen(go), "r")) == NULL ||
+	    (ofp = fmemopen(out, len, "w")) == NULL)
+		err(1, "fmemopen");
+	setvbuf(ofp, NULL, _IONBF, 0);
+	nd10_setio(c, in, ofp);
+	for (steps = idle = 0; idle < IDLE || nd10_icount(c) == 0;
+	    steps += CHUNK) {
+		if (steps >= MAXSTEPS)
+			errx(1, "%s: does not halt", names[native]);
+		if ((n = nd10_run(c, CHUNK, MAXSTEPS)) < 0)
+			errx(1, "%s: %s", names[native], nd10_error(c));
+		idle = n ? 0 : idle + CHUNK;
+	}
+	nd10_destroy(c);
+	fclose(ofp);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *prom = argc > 1 ? argv[1] : "prom.hex";
+	static const int modes[] = { 0, 1, 3 };
+	char uc[64], nat[64], ls[64], pg[64];
+	char *sum;
+	int i;
+
+	mkprog();
+	memset(uc, 0, sizeof(uc));
+	memset(nat, 0, sizeof(nat));
+	memset(ls, 0, sizeof(ls));
+	run(prom, 0, uc, sizeof(uc) - 1);
+	run(prom, 1, nat, sizeof(nat) - 1);
+	run(prom, 3, ls, sizeof(ls) - 1);
+	if ((sum = strchr(uc, '!')) == NULL || strlen(sum) != 9)
+		errx(1, "microcode printed \"%s\"", uc);
+	if (strcmp(uc, nat) || strcmp(uc, ls))
+		errx(1, "microcode, native and lockstep print %s, %s and %s",
+		    uc, nat, ls);	// after the echo of the console
+	printf("natest: %d cases, sum %.6s\n", ncases, sum + 1);
+
+	mkpaging(IIE_PV | IIE_PF);
+	for (i = 0; i < 3; i++) {	// the tables are set natively
+		memset(pg, 0, sizeof(pg));
+		run(prom, modes[i], pg, sizeof(pg) - 1);
+		if ((sum = strchr(pg, '!')) == NULL || strcmp(sum, "!P2RP3S"))
+			errx(1, "%s paging printed \"%s\"", names[modes[i]],
+			    pg);
+	}
+	mkpaging(IIE_PV);
+	memset(pg, 0, sizeof(pg));
+	run(prom, 0, pg, sizeof(pg) - 1);
+	if ((sum = strchr(pg, '!')) == NULL || strcmp(sum, "!P2RP"))
+		errx(1, "paging without page faults printed \"%s\"", pg);
+	printf("natest: paging faults and shadow tables\n");
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024 Anders Magnusson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Interface for running Nord-10 machines from other programs.
+ *
+ * Each machine is independent and they can be run on different
+ * threads; a machine must only be used by one thread at a time, but
+ * any thread may raise its interrupt lines with nd10_irq().
+ * The console input FILE given to nd10_setio() is closed at its end
+ * or by nd10_destroy().
+ * nd10_step() and nd10_run() return -1 on an error the machine cannot
+ * go on from, such as an unimplemented microcode feature; nd10_error()
+ * tells what it was, and the machine can then only be destroyed.
+ */
+
+struct nd10;
+
+struct nd10 *nd10_create(void);
+int nd10_loadprom(struct nd10 *, char *file, int words);
+void nd10_loadmem(struct nd10 *, int addr, unsigned short *w, int n);
+int nd10_loadprog(struct nd10 *, char *file, int syms, int *entry);
+int nd10_setmem(struct nd10 *, long words);
+int nd10_setcore(struct nd10 *, char *file);
+long nd10_resident(struct nd10 *);
+void nd10_setio(struct nd10 *, FILE *in, FILE *out);
+void nd10_settape(struct nd10 *, char *file);
+int nd10_setengine(struct nd10 *, char *name);
+int nd10_setclock(struct nd10 *, char *name);
+void nd10_setnative(struct nd10 *, int on);
+void nd10_irq(struct nd10 *, int level);
+long nd10_step(struct nd10 *, long nsteps);
+long nd10_run(struct nd10 *, long nsteps, long ninsns);
+long nd10_icount(struct nd10 *);
+char *nd10_error(struct nd10 *);
+int nd10_save(struct nd10 *, char *file);
+int nd10_restore(struct nd10 *, char *file);
+void nd10_destroy(struct nd10 *);
+
+/* batch.c */
+int nd10_batch(char *manifest, char *prom, int words, char *engine,
+    int native, int nthreads);
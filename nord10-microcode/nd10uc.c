@@ -26,27 +26,114 @@
 /*
  * Trivial implementation of a Nord-10 microcode emulator.
  * Ugly code, in most cases a hack.  Expect 32-bit int.
- * No real support for correct interrupts or interrupt levels.
+ * All 16 interrupt levels, but only the RTC (13) and console input (12)
+ * request them; other devices are polled.
  * Only written to be able to run INSTRUCTION-B.
  *
  * Reads prom.hex for the 1k microcode.
  * Flags:
  *	-4		reads prom4k.hex instead (commercial microcode)
- *	-t <file>	trace the microcode
+ *	-t <file>	trace the microcode, in binary; see trdec.
  *	-h <file> 	attach a punched tape to device 400
+ *	-H		bulk load a BPUN tape from -h: when the
+ *			microcode loader (&) starts the reader the block
+ *			goes straight to memory, only its last word
+ *			through the microcode, so D is left with the
+ *			checksum of that word, not of the block.  A tape
+ *			the guest reads itself is not touched.  Not
+ *			with -R or -P.
  *	-d <file>	write instruction code execution trace to file
  *	-i <file>	Read microcode commands from file first.
+ *	-l <file>	load an a.out from nd100-as, or a BPUN tape, into
+ *			memory and start it at its entry (before -i).
+ *	-y		keep the symbols of the -l a.out, to name the
+ *			addresses in -d, -f and -G.
+ *	-M <n>		words of memory, 64k (the default) to 512k, with k
+ *			or M after n for units.  Only the pages used take
+ *			host memory; how many is told at exit.
+ *	-m <file>	keep memory in file, which then lasts from one run
+ *			to the next like core; see nd10_setcore().
+ *	-n		execute the instructions that it knows natively
+ *			instead of by microcode.
+ *	-L		check the native instructions against the microcode:
+ *			windows of 1024 instructions in every 65536 run by
+ *			microcode in lockstep with them, the rest natively,
+ *			and it stops at the first difference.  -LL checks
+ *			every instruction, a slow verification mode.
+ *	-V		verify the entry point table against the EPG gates.
+ *	-e <engine>	microcode engine: switch (default), threaded or
+ *			block.  Tracing always uses switch.
+ *	-k <clock>	RTC clock: fetch (default) ticks every 10001
+ *			instructions, paced every 20 ms of host time and
+ *			turbo as fetch, but skips ahead to the next tick
+ *			when the guest waits for it on level 0.  A guest
+ *			that waits sleeps in the host; see idle().
+ *	-B <n>		benchmark: run n micro-steps with each engine and
+ *			print rates.  The first, per-use decode, takes the
+ *			fields each micro-word uses from it as it runs, as
+ *			before the decoded table.  Needs a program, from
+ *			-i, -r or -l with a start address; the console
+ *			alone runs no instructions.
+ *	-c <n|@addr>	checkpoint at instruction count n, or at the first
+ *			fetch from (octal) addr, and run a continuation
+ *			for each -a from there.
+ *	-a <file>	console input for a continuation from -c, which
+ *			writes its output to file.out.  May be repeated.
+ *	-x <n>		end continuations after n instructions.  They also
+ *			end when the guest halts, or when it waits for input
+ *			after the end of its -a file with the RTC interrupt
+ *			off; one that spins without either needs -x.
+ *	-s <file>	save a snapshot of the machine to file on SIGUSR2,
+ *			and on SIGINT, SIGTERM or SIGHUP before exiting.
+ *			A second of these exits at once, for a guest
+ *			that does not get to a fetch or a console poll.
+ *	-r <file>	restore the machine from a snapshot at start.
+ *	-b <file>	run the jobs in a manifest, see batch.c, and report.
+ *	-j <n>		threads for -b, default one per cpu.
+ *	-R <file>	record the console and tape input to file.  Not
+ *			with -k paced, whose ticks depend on host time.
+ *	-P <file>	replay the input recorded with -R instead of
+ *			reading the terminal, -i or the tape.
+ *	-p <file>	profile the microcode and write a report to file
+ *			at exit, also on SIGINT, SIGTERM or SIGHUP.  Uses
+ *			the switch engine.
+ *	-G <file>	profile the guest program and write its call
+ *			stacks in folded format to file, and the counts
+ *			per instruction entry point to file.ops, at exit.
+ *	-f <file>	write the flight recorder to file, also each time
+ *			the guest halts.  It is always written on SIGUSR1
+ *			and on microcode errors, to stderr without -f.
  */
 
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "epg.h"
+#include "nd10.h"
+#include "utrace.h"
+
+#ifndef MAP_NORESERVE
+#define	MAP_NORESERVE	0
+#endif
 
 #define	M_LALT(x)	(((x)->line >> 0) & 1)
 #define	M_ENDID(x)	(((x)->line >> 1) & 1)
@@ -88,53 +175,297 @@
 
 union ucent {
 	int line;
-} rom[4096];
-
-volatile int tflag;
-FILE *dfp;
-
-int epg(int, int);
-void arith(union ucent *), jump(union ucent *), iblock(union ucent *),
-	loop(union ucent *);;
-void ioexec(union ucent *), ident(union ucent *);
+};
 
-int mpc, wrtout;
+/*
+ * Pre-decoded microinstruction.  The PROM is decoded into this table
+ * once when it is loaded, so the execution functions never need to
+ * shift and mask the raw word.  ormap() patches a private copy.
+ * Some fields alias the same bits, as in the M_* macros above.
+ */
+struct ucdec {
+	int line;		/* raw word, for traces and messages */
+	unsigned char op;	/* 0 arith, 1 interblock, 2 jump, 3 loop */
+	unsigned char alu;	/* ALU function, ALUM for loop */
+	unsigned char a, b, dest;
+	unsigned char cycle;
+	unsigned char orspecs;
+	unsigned char level;	/* bit 12-15, LEVEL and special case 2 */
+	unsigned char tc, cond;	/* bit 12-14 and 15, also JTC/JCOND */
+	unsigned char arsel;
+	unsigned char chlev;	/* also DIRECT for interblock */
+	unsigned char ssave;
+	unsigned char priv, car;
+	unsigned short addr;
+
+	/* loop only */
+	unsigned char lalt, endid, term, lb, tg, lm;
+	unsigned char lsh32, lsht, lshr, lorsht, lalul;
+
+	void (*fn)(struct nd10 *, struct ucdec *);	/* threaded code */
+	unsigned short blen;		/* superblock length from here */
+};
+
+/* Writes to fields that overlap others */
+#define	D_LEVEL_W(x,v)	((x)->level = (v), (x)->tc = (v) & 7, (x)->cond = (v) >> 3)
+#define	D_TC_W(x,v)	((x)->tc = (v), (x)->level = ((x)->level & 8) | (v))
+
+/* Execution engines, selected with -e */
+#define	E_SWITCH	0	/* switch on the op field */
+#define	E_THREAD	1	/* call the handler of each word */
+#define	E_BLOCK		2	/* threaded, with superblocks */
+char *enames[] = { "switch", "threaded", "block" };
+
+void arith(struct nd10 *, struct ucdec *), jump(struct nd10 *, struct ucdec *),
+	iblock(struct nd10 *, struct ucdec *), loop(struct nd10 *, struct ucdec *);;
+void ioexec(struct nd10 *, struct ucdec *), ident(struct nd10 *, struct ucdec *);
+static void udecode(struct ucdec *, int), udecuse(struct ucdec *, int);
+static void run(struct nd10 *, long), runsw(struct nd10 *, long),
+    runthr(struct nd10 *, long), runblk(struct nd10 *, long);
+static void uclassify(struct ucdec *), mkblocks(struct nd10 *);
+#ifndef LIBND10
+static void bench(struct nd10 *, long);
+#endif
 
 typedef unsigned short Reg;
 typedef Reg Rblk[16];
 typedef unsigned long long ull;
 
-Rblk A, D, T, X, B, SP, L, S1, S2;
-Reg CP, SH[2], Alatch[2];
-unsigned char STS[16];
-
-// There is an AC for each arithmetic module.
-// It clocks in the latest output from the 74181 ALU.
-// But, only for the M or L output unless it is a loop
-// microcode instruction, where both are clocked.
-// See 1120 ACKL/BCKL and 1101 74174.
-Reg AC[2];	// 0 == least, 1 == most.
-
-Reg H, R, CAR, PCR;	// 05, 13, 15
-#define	IR CAR	// same reg
-int bZ, bO, bS, bC, bCl;
-
-Reg ioreg;
-Reg oldCP;
-int pil, pid, pie, pvl, iic, iid, iie, SC;
-int pgon, inton;
+void rtc_int(struct nd10 *), rtc_pace(struct nd10 *);
+void rtcsched(struct nd10 *, long);
+long rtcleft(struct nd10 *);
+static long hostns(void);
+static void idle(struct nd10 *);
+
+#define	RTCTICK		10001	/* fetches between RTC ticks */
+#define	RTCNS		20000000L	/* ns between paced ticks */
+#define	RTCPOLL		1000	/* fetches between looks at the time */
+#define	IDLEPOLLS	64	/* same console status this many times */
+#define	IDLEGAP		16	/* with at most this many fetches between */
+#define	IDLEMS		100	/* longest sleep in idle() */
+#define	TTIPOLL		1000	/* fetches between looks for input, -R/-P */
+#define	TTILINE		012	/* logged console input for level 12 */
+
+#define	K_FETCH		0	/* RTC clock modes, see rtcsched() */
+#define	K_PACED		1
+#define	K_TURBO		2
+char *knames[] = { "fetch", "paced", "turbo" };
+#define	NEVENTS		16	/* pending events, see evsched() */
+#define	NTLB		64	/* translations kept, see pgmap() */
+#define	MEMMIN		65536L	/* words of memory, see memalloc() */
+#define	MEMMAX		(512L * 1024)	/* all that PT_PPN reaches */
+#define	MEMCHUNK	2048	/* words in a snapshot hole */
+#define	BPUNLDR		01641	/* mpc of the & loader's IOX, see ptrbulk() */
+
+/* Native instruction handlers, indexed like epgtab. */
+typedef int (*nfn_t)(struct nd10 *);
+nfn_t ntab[EPGTABSZ];
+#define	NBATCH	1024	/* max native instructions per fetch cycle */
+static void ninit(void);
+
+/* Lockstep comparison of native and microcode, see lsstart. */
+struct cpstate {
+	Rblk A, D, T, X, B, L;
+	unsigned char STS[16];
+	Reg CP, H, CAR, PCR, ioreg;
+	int pil, pid, pie, iie, iid, iic, pgon, inton;
+};
+
+#define	NLSLOG	16	/* memory writes kept per side */
+#define	NHIST	32	/* instructions kept for the dump */
+#define	LSPERIOD 65536	/* -L checks a window in every LSPERIOD insns, */
+#define	LSWINDOW 1024	/* of LSWINDOW of them; -LL checks all */
+
+struct lslog {
+	int n;
+	Reg addr[NLSLOG], old[NLSLOG], new[NLSLOG];
+};
+static void lsstart(struct nd10 *, nfn_t), lscheck(struct nd10 *),
+    lslog(struct nd10 *, int);
 
-int rtc_doint, rtc_rft, rtc_ctr;
-void rtc_int();
+#define	FRINSNS	64		/* flight recorder, a power of 2 */
+#define	FRSTEPS	1024		/* ditto */
 
-unsigned short mem[65536];
+/*
+ * All state of one machine.  Everything that works on it is passed
+ * the machine as c; see nd10.h for the embedding interface.
+ */
+struct nd10 {
+	/* options */
+	volatile int tflag;
+	FILE *dfp, *tfp;	/* -d and -t traces */
+	FILE *ifd;		/* console input read first */
+	FILE *ofp;		/* console output */
+	char *hname;		/* paper tape */
+	int sfd;		/* console input, -1 for none */
+	int rawdec, engine, native, lockstep;
+	int promsz;
+
+	union ucent rom[4096];
+	struct ucdec utab[4096];
+	int mpc, wrtout;
+
+	Rblk A, D, T, X, B, SP, L, S1, S2;
+	Reg CP, SH[2], Alatch[2];
+	unsigned char STS[16];
+
+	// There is an AC for each arithmetic module.
+	// It clocks in the latest output from the 74181 ALU.
+	// But, only for the M or L output unless it is a loop
+	// microcode instruction, where both are clocked.
+	// See 1120 ACKL/BCKL and 1101 74174.
+	Reg AC[2];	// 0 == least, 1 == most.
+
+	Reg H, R, PCR;		// 05, 13
+	union {
+		Reg CAR, IR;	// 15, the same register
+	};
+	int bZ, bO, bS, bC, bCl;
+
+	Reg ioreg;
+	Reg oldCP;
+	int pil, pid, pie, pvl, iic, iid, iie, SC;
+	int pgon, inton;
+	int pkl;		/* highest level requested and enabled */
+	int devlines;		/* levels devices hold requested, see ttiset() */
+	atomic_uint irqlines;	/* raised by nd10_irq(), not yet in pid */
+	atomic_int irqpend;	/* look at the levels at the next fetch */
+	atomic_int ttikick;	/* console input came, see ttiline() */
+
+	/* paging, see pgmap() */
+	Reg pcr[16];		/* per level: PT, APT and ring */
+	Reg ptab[4][64];	/* the page tables */
+	struct tlbent {
+		int t_tag;	/* 1 + table, ring and page; 0 unused */
+		Reg t_perm;	/* accesses allowed without a fault */
+		unsigned short *t_page;
+	} tlb[NTLB];
+	Reg pgs, pes, pea;
+	int pglock;		/* pgs holds a fault that is not read */
+	int ralt;		/* R is an operand address through the APT */
+	int pgtrap;		/* an access of this cycle trapped */
+
+	int rtc_doint, rtc_rft;
+	long rtc_due;		/* next tick at this host time when paced */
+	int kmode;		/* RTC clock, K_* */
+	long idleic;		/* last console status poll, see idle() */
+	int idlest, idlen;
+	long icount;		/* instructions fetched */
+	long evnext;		/* first event in evq, at this fetch */
+	int nev;
+	struct event {
+		long e_at;
+		void (*e_fn)(struct nd10 *);
+	} evq[NEVENTS];		/* a heap on e_at */
+	long ilimit;		/* no native batches from this count */
+
+	unsigned short *mem;	/* physical memory, see memalloc() */
+	long memsize;		/* in words */
+	int memanon;		/* from memalloc(), not a file */
+	int memcore;		/* mapped shared from a core file (-m) */
+	char *snapname;		/* saved to on snapreq */
+
+	/* checkpoint, see checkpoint() */
+	int ckarm;		/* 1 waiting, 2 in a continuation */
+	long ckinsn;		/* at this instruction count */
+	int ckpc;		/* or at a fetch from here */
+	char **altv;		/* inputs of the continuations */
+	int altc, altn;		/* altn: this continuation */
+	struct timespec ckt0;	/* time of the checkpoint */
+	long xinsn;		/* continuations run this long */
+
+	/* input log, see inlog() */
+	FILE *recfp, *playfp;	/* -R and -P */
+	long niox;		/* input IOX done */
+	long pl_n, pl_insn;	/* next replayed input, pl_n -1 at end */
+	int pl_dev, pl_val;
+	int inlast[3];		/* last status of 0302, 0402 and TTILINE */
+
+	/* errors in nd10_run(), see uerrx() */
+	sigjmp_buf *errjb;	/* where to go, NULL outside of a run */
+	char errmsg[256];
+
+	/* flight recorder, see frdump() */
+	FILE *frfp;		/* -f */
+	unsigned int frin, frun;	/* instructions and steps recorded */
+	struct frinsn {
+		long f_icount;
+		Reg f_cp, f_ir, f_a, f_d, f_t, f_x, f_b, f_l;
+		unsigned char f_sts, f_pil;
+	} frins[FRINSNS];
+	unsigned short frmpc[FRSTEPS];
+
+	struct ucprof {		/* -p, per microcode address */
+		unsigned long p_n;	/* executed */
+		unsigned long p_jmp;	/* jumps taken */
+		unsigned long p_iter;	/* LOOP iterations */
+	} *uprof;
+	struct gprofile *gprof;	/* -G, see gfetch() */
+
+	volatile int ttistat;
+	int tti_active, ttostat;
+	unsigned char *ptrimg;	/* mapped tape, NULL if not read */
+	long ptrlen, ptrpos;
+	unsigned char ptr_char;
+	int ptr_intr;
+	int ptr_bulk, ptrfast;	/* -H, and ptrimg is rewritten */
+	struct ysym {
+		int y_val;
+		char *y_name;
+	} *syms;		/* of the program loaded, by value */
+	int nsyms;
+	int incnt;
+
+	/* lockstep */
+	int lsarm;
+	struct cpstate lsbefore, lsnat;
+	struct lslog lsl[2];		/* native, microcode */
+	struct cpstate hist[NHIST];
+	long lsinsn;
+};
+
+#ifndef LIBND10
+static struct nd10 *mainc;	/* main()'s, for atexit and fork */
+#endif
+
+/* Snapshot requested by a signal, 2 to exit after it */
+static volatile sig_atomic_t snapreq;
+static void snapshot(struct nd10 *);
+static void checkpoint(struct nd10 *), ckend(struct nd10 *, char *);
+static int ckstuck(struct nd10 *, int);
+static void plread(struct nd10 *);
+#ifndef LIBND10
+static void trinit(struct nd10 *), coninit(struct nd10 *);
+static void profinit(struct nd10 *, char *, char *, char *);
+static void gprofinit(struct nd10 *, char *);
+static void ttiwake(struct nd10 *);
+#endif
+static void frdump(struct nd10 *, char *);
+static void frsig(struct nd10 *);
+static void uerrx(struct nd10 *, const char *, ...);
+static void evsched(struct nd10 *, void (*)(struct nd10 *), long),
+    evcancel(struct nd10 *, void (*)(struct nd10 *));
+static int ptropen(struct nd10 *);
+static void ptrclose(struct nd10 *), ptrbulk(struct nd10 *, int);
+static long bpunblk(unsigned char *, long, int *, long *);
+static char *symname(struct nd10 *, int, char *, int);
+static void pgabort(struct nd10 *, int, int);
+static void intcalc(struct nd10 *), intlevel(struct nd10 *),
+    intdrop(struct nd10 *, int), ttiset(struct nd10 *), ttiline(struct nd10 *);
+static void ttipoll(struct nd10 *);
+static int intchange(struct nd10 *), ttiready(struct nd10 *);
+static unsigned short *memalloc(long);
+static int memzero(struct nd10 *, long);
+static void tlbflush(struct nd10 *);
+static long evwhen(struct nd10 *, void (*)(struct nd10 *));
+
+/* Flight recorder dump requested by SIGUSR1 */
+static volatile sig_atomic_t frreq;
+
+/* -t trace of the machine of main(), see trput() */
+static struct trrec trcur;	/* the step being traced */
+static int trbusy;		/* trcur is started */
 
-volatile int ttistat = 001;
-int tti_active;
-int sfd;
-char *hname;
-FILE *ifd, *tfp;
-int promsz = 1024;
 
 /* internal interrupt enable register */
 #define IIE_MC		0000002 /* Monitor call */
@@ -165,969 +496,4541 @@ int promsz = 1024;
 #define STS_C		0000100
 #define STS_M		0000200
 
+#ifndef LIBND10	/* the library has no main program */
+static struct termios otio;
+
+static void
+ttyreset(void)
+{
+	tcsetattr(0, TCSANOW, &otio);
+}
+
+static pid_t mrpid;
+
+/* how much of a -M memory the run used */
+static void
+memreport(void)
+{
+	struct nd10 *c = mainc;
+
+	if (getpid() == mrpid)
+		fprintf(stderr, "memory: %ldk of %ldk words resident\n",
+		    nd10_resident(c) / 1024, c->memsize / 1024);
+}
+
 static void
-sig_io(int signo)
+sig_snap(int signo)
 {
-	ttistat |= 010;
+	if (snapreq == 2 && signo != SIGUSR2) {	// the first was not seen
+		ttyreset();
+		_exit(1);
+	}
+	snapreq = signo == SIGUSR2 ? 1 : 2;
 }
 
+static void
+sig_fr(int signo)
+{
+	(void)signo;
+	frreq = 1;
+}
 
 int
 main(int argc, char *argv[])
 {
-	struct termios p, op;
-	union ucent *uc;
+	struct nd10 *c;
+	struct termios p;
+	char *prom = "prom.hex", *rname = NULL;
+	char *manifest = NULL, *pname = NULL, *gname = NULL, *lname = NULL;
+	char *mname = NULL, *ep;
+	long msize;
+	long bsteps = 0;
+	int i, ch, psize = 1024, nthreads = 0, ysyms = 0;
 	FILE *fp;
-	char hbuf[10];
-	char *prom = "prom.hex";
-	int i, ch;
 
-	while ((ch = getopt(argc, argv, "4t:d:h:i:")) != -1) {
+	c = mainc = nd10_create();
+	c->sfd = STDIN_FILENO;
+	while ((ch = getopt(argc, argv, "4nLt:d:h:Hi:l:m:M:ye:k:c:a:x:s:r:R:P:f:p:G:b:j:B:V")) != -1) {
 		switch (ch) {
 		case '4':
 			prom = "prom4k.hex";
-			promsz = 4096;
+			psize = 4096;
 			break;
 
+		case 'n': c->native = 1; break;
+		case 'L': c->lockstep = c->lockstep ? 2 : 1; break;
+
 		case 't':
-			if ((tfp = fopen(optarg, "w")) == NULL)
+			if ((c->tfp = fopen(optarg, "w")) == NULL)
 				err(1, "fopen t");
-			tflag = 1;
+			c->tflag = 1;
 			break;
 
 		case 'd':
-			if ((dfp = fopen(optarg, "w")) == NULL)
+			if ((c->dfp = fopen(optarg, "w")) == NULL)
 				err(1, "fopen d");
 			break;
 
-		case 'h': hname = optarg; break;
+		case 'h': c->hname = optarg; break;
+		case 'H': c->ptr_bulk = 1; break;
 
 		case 'i':
-			if ((ifd = fopen(optarg, "r")) == NULL)
+			if ((c->ifd = fopen(optarg, "r")) == NULL)
 				err(1, "fopen");
 			break;
 
+		case 'l': lname = optarg; break;
+		case 'm': mname = optarg; break;
+
+		case 'M':
+			msize = strtol(optarg, &ep, 0);
+			if (*ep == 'k' || *ep == 'K')
+				msize *= 1024;
+			else if (*ep == 'm' || *ep == 'M')
+				msize *= 1024 * 1024;
+			if (nd10_setmem(c, msize) < 0)
+				errx(1, "bad memory size %s", optarg);
+			atexit(memreport);
+			mrpid = getpid();
+			break;
+		case 'y': ysyms = 1; break;
+
+		case 'e':
+			if (nd10_setengine(c, optarg) < 0)
+				errx(1, "unknown engine %s", optarg);
+			break;
+
+		case 'k':
+			if (nd10_setclock(c, optarg) < 0)
+				errx(1, "unknown clock %s", optarg);
+			break;
+
+		case 'c':
+			if (*optarg == '@')
+				c->ckpc = strtol(optarg + 1, NULL, 8);
+			else
+				c->ckinsn = strtol(optarg, NULL, 0);
+			c->ckarm = 1;
+			break;
+
+		case 'a':
+			if ((c->altv = realloc(c->altv,
+			    (c->altc + 1) * sizeof(char *))) == NULL)
+				err(1, "realloc");
+			c->altv[c->altc++] = optarg;
+			break;
+
+		case 'x': c->xinsn = strtol(optarg, NULL, 0); break;
+
+		case 's': c->snapname = optarg; break;
+		case 'r': rname = optarg; break;
+
+		case 'R':
+			if ((c->recfp = fopen(optarg, "w")) == NULL)
+				err(1, "%s", optarg);
+			break;
+
+		case 'P':
+			if ((c->playfp = fopen(optarg, "r")) == NULL)
+				err(1, "%s", optarg);
+			plread(c);
+			break;
+
+		case 'f':
+			if ((c->frfp = fopen(optarg, "w")) == NULL)
+				err(1, "%s", optarg);
+			break;
+
+		case 'p': pname = optarg; break;
+		case 'G': gname = optarg; break;
+
+		case 'b': manifest = optarg; break;
+		case 'j': nthreads = atoi(optarg); break;
+
+		case 'V':
+			epginit();
+			if ((i = epgverify()) != 0)
+				errx(1, "%d entry points differ", i);
+			printf("entry point table ok\n");
+			return 0;
+
+		case 'B':
+			if ((bsteps = strtol(optarg, NULL, 0)) <= 0)
+				errx(1, "bad step count %s", optarg);
+			break;
+
 		default:
 			errx(1, "usage: %s [-t] [-h tapename ]", argv[0]);
 		}
 
 	}
 
-	if ((fp = fopen(prom, "r")) == NULL)
-		err(1, "fopen");
-	for (i = 0; i < promsz; i++) {
-		if (fgets(hbuf, 10, fp) == NULL)
-			err(1, "fgets");
-		rom[i].line = strtol(hbuf, 0, 16);
+	if (c->ckarm && c->altc == 0)
+		errx(1, "-c needs at least one -a");
+	if (c->kmode == K_PACED && (c->recfp || c->playfp))
+		errx(1, "-k paced ticks by host time, not with -R or -P");
+	if (c->tflag)
+		trinit(c);
+	if (pname)
+		profinit(c, pname, prom, argv[0]);
+	if (gname)
+		gprofinit(c, gname);
+	if (manifest)
+		return nd10_batch(manifest, prom, psize, enames[c->engine],
+		    c->lockstep ? c->lockstep + 1 : c->native, nthreads) != 0;
+	if (nd10_loadprom(c, prom, psize) < 0)
+		err(1, "%s", prom);
+	if (c->lockstep)
+		c->native = c->lockstep == 1;
+	if (mname && nd10_setcore(c, mname) < 0)
+		err(1, "%s", mname);
+	if (rname && nd10_restore(c, rname) < 0)
+		err(1, "restore %s", rname);
+	if (lname) {
+		if (nd10_loadprog(c, lname, ysyms, &i) < 0)
+			err(1, "%s", lname);
+		if (i >= 0 && c->playfp == NULL) {	// start it from the console
+			if ((fp = tmpfile()) == NULL)
+				err(1, "tmpfile");
+			fprintf(fp, "%o!", i);
+			while (c->ifd && (ch = getc(c->ifd)) != EOF)
+				putc(ch, fp);
+			if (c->ifd)
+				fclose(c->ifd);
+			rewind(fp);
+			c->ifd = fp;
+		}
+	}
+
+	if (bsteps) {
+		if (c->ifd == NULL && rname == NULL)
+			errx(1, "-B needs a program, from -i, -r or -l");
+		c->ttistat = 0;
+		bench(c, bsteps);
+		return 0;
 	}
-	fclose(fp);
 
-	{
-		fcntl(STDIN_FILENO, F_SETOWN, getpid());
-		int oflags = fcntl(STDIN_FILENO, F_GETFL);
-		fcntl(STDIN_FILENO, F_SETFL, oflags | FASYNC);
+	if (c->playfp) {		// no terminal, all input is in the log
+		c->sfd = -1;
+		goto go;
 	}
-	signal(SIGIO, sig_io);
-	if (fcntl(sfd, F_SETFL, O_NONBLOCK|O_ASYNC) < 0)
+	if (fcntl(c->sfd, F_SETFL, O_NONBLOCK) < 0)
 		err(1, "fcntl");
-	tcgetattr(0, &op);
+	if (tcgetattr(0, &otio) == 0)
+		atexit(ttyreset);
 	tcgetattr(0, &p);
 	cfmakeraw(&p);
 	p.c_lflag |= ISIG;
 	tcsetattr(0, TCSANOW, &p);
-	ttistat = 0;
-	mpc = 1;
+	c->ttistat = 0;
+
+go:	coninit(c);
+	signal(SIGUSR1, sig_fr);
+	if (c->snapname)
+		signal(SIGUSR2, sig_snap);
+	if (c->snapname || pname || gname || mrpid) {	// exit cleanly
+		signal(SIGINT, sig_snap);
+		signal(SIGTERM, sig_snap);
+		signal(SIGHUP, sig_snap);
+	}
+	run(c, -1);
 
-	for (;;) {
+	return 0;
+}
+#endif
 
-		uc = &rom[mpc];
-		if (tflag)
-			fprintf(tfp, "%04o: %08X", mpc, uc->line);
-		switch (M_OP(uc)) {
-		case 0:
-			arith(uc);
-			break;
+/*
+ * Embedding interface, see nd10.h.
+ */
+static pthread_once_t nd10once = PTHREAD_ONCE_INIT;
 
-		case 1: // interblock
-			iblock(uc);
-			break;
+static void
+nd10init(void)
+{
+	epginit();
+	ninit();
+}
 
-		case 2:
-			jump(uc);
-			if (tflag)
-				fprintf(tfp, "\n");
-			continue;
+struct nd10 *
+nd10_create(void)
+{
+	struct nd10 *c;
+
+	pthread_once(&nd10once, nd10init);
+	if ((c = calloc(1, sizeof(struct nd10))) == NULL)
+		return NULL;
+	if ((c->mem = memalloc(MEMMIN)) == NULL) {
+		free(c);
+		return NULL;
+	}
+	c->memsize = MEMMIN;
+	c->memanon = 1;
+	c->ofp = stdout;
+	c->sfd = -1;
+	c->promsz = 1024;
+	c->ttostat = 010;
+	c->mpc = 1;
+	c->ilimit = LONG_MAX;
+	c->ckpc = -1;
+	c->xinsn = LONG_MAX;
+	c->evnext = LONG_MAX;
+	rtcsched(c, 1);
+	return c;
+}
 
-		case 3: // LOOP
-			loop(uc);
-			break;
+/*
+ * Read a PROM image, one hex word per line, and decode it.
+ */
+int
+nd10_loadprom(struct nd10 *c, char *file, int words)
+{
+	FILE *fp;
+	char hbuf[10];
+	int i;
 
-		default:
-			errx(1, "op not implemented: %d line %o", M_OP(uc), mpc);
+	if ((fp = fopen(file, "r")) == NULL)
+		return -1;
+	c->promsz = words;
+	for (i = 0; i < c->promsz; i++) {
+		if (fgets(hbuf, 10, fp) == NULL) {
+			fclose(fp);
+			return -1;
 		}
-		mpc++;
-		if (tflag)
-			fprintf(tfp, "\n");
+		c->rom[i].line = strtol(hbuf, 0, 16);
 	}
-
+	fclose(fp);
+	for (i = 0; i < 4096; i++) {
+		udecode(&c->utab[i], c->rom[i].line);
+		uclassify(&c->utab[i]);
+	}
+	mkblocks(c);
 	return 0;
 }
 
+/*
+ * Physical memory, MEMMIN to MEMMAX words, the 512 pages that a page
+ * table entry can name.  It is reserved in one piece that is
+ * not backed by swap, so the host only gives it pages as the guest
+ * touches them: a large memory costs what is used of it, as do many
+ * machines side by side.  Snapshots leave holes for the pages that are
+ * all zeroes.
+ */
+static unsigned short *
+memalloc(long words)
+{
+	unsigned short *m;
+
+	m = mmap(NULL, words * sizeof(m[0]), PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	return m == MAP_FAILED ? NULL : m;
+}
+
+/*
+ * Is the MEMCHUNK at i all zeroes?  A page of memalloc() that the host
+ * does not hold is, and is not looked at so that it stays that way.
+ */
+static int
+memzero(struct nd10 *c, long i)
+{
+	unsigned short *p = c->mem + i;
+	unsigned char v;
+	long n;
+
+	if (c->memanon && mincore(p, MEMCHUNK * sizeof(c->mem[0]),
+	    (void *)&v) == 0 &&
+	    (v & 1) == 0)
+		return 1;
+	for (n = 0; n < MEMCHUNK; n++)
+		if (p[n])
+			return 0;
+	return 1;
+}
+
+/* a new, cleared, memory of words (rounded up to pages) */
 int
-pk_calc()
+nd10_setmem(struct nd10 *c, long words)
 {
-	int i, d = pid & pie;
+	unsigned short *m;
 
-	for (i = 15; i >= 0; i--)
-		if (d & (1 << i))
-			return i;
+	words = (words + 01777) & ~01777L;
+	if (words < MEMMIN || words > MEMMAX || c->memcore) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((m = memalloc(words)) == NULL)
+		return -1;
+	munmap(c->mem, c->memsize * sizeof(c->mem[0]));
+	c->mem = m;
+	c->memsize = words;
+	c->memanon = 1;
+	tlbflush(c);
 	return 0;
 }
 
+/* words of memory that the host holds */
+long
+nd10_resident(struct nd10 *c)
+{
+	long pg = sysconf(_SC_PAGESIZE), len, i, n = 0;
+	char *vec;
+
+	len = c->memsize * sizeof(c->mem[0]);
+	if ((vec = malloc((len + pg - 1) / pg)) == NULL)
+		return -1;
+	if (mincore(c->mem, len, (void *)vec) == 0)
+		for (i = 0; i < (len + pg - 1) / pg; i++)
+			n += vec[i] & 1;
+	free(vec);
+	return n * (pg / sizeof(c->mem[0]));
+}
 
 /*
- * Post an internal interrupt for the given source.
+ * Keep memory in file, as core keeps it with the power off: it is
+ * mapped shared, so what the guest writes is in the file at once and
+ * the next run starts with it, and other programs may look at or
+ * patch it while the machine runs.  The file is the memory words in
+ * host byte order; it is created, or extended with zeroes, as needed.
  */
-void
-int14(int intr)
+int
+nd10_setcore(struct nd10 *c, char *file)
 {
-int xintr = intr;
-	iid |= intr;	/* set detect flipflop */
-	for (iic = 0; (intr & 1) == 0; iic++, intr >>= 1)
-		;
-	if (iid & iie) /* if internal int enabled, post priority int */
-		pid |= (1 << 14);
+	size_t len;
+	unsigned short *m;
+	struct stat st;
+	int fd;
+
+	len = c->memsize * sizeof(c->mem[0]);
+	if ((fd = open(file, O_RDWR|O_CREAT, 0666)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 ||
+	    (st.st_size < (off_t)len && ftruncate(fd, len) < 0)) {
+		close(fd);
+		return -1;
+	}
+	m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return -1;
+	munmap(c->mem, len);
+	c->mem = m;
+	c->memcore = 1;
+	c->memanon = 0;
+	tlbflush(c);
+	return 0;
 }
 
-
+/* a forked run of its own gets a private copy of the core file */
 static void
-dprint()
+coreprivate(struct nd10 *c)
 {
-//	if (wrtout == 0)
-//		return;
-	fprintf(dfp, "%06o: IR=%06o STS=%06o D=%06o B=%06o "
-	    "L=%06o A=%06o T=%06o X=%06o\n",
-	    oldCP, IR, STS[pil] + (pil << 8) + (inton << 15),
-	    D[pil], B[pil], L[pil], A[pil], T[pil], X[pil]);
-	fprintf(dfp, "N: %d\n", rtc_ctr);
-	fflush(dfp);
+	unsigned short *m;
+	long i;
+
+	if (!c->memcore)
+		return;
+	if ((m = memalloc(c->memsize)) == NULL)
+		err(1, "memory");
+	for (i = 0; i < c->memsize; i += MEMCHUNK)
+		if (!memzero(c, i))
+			memcpy(m + i, c->mem + i, MEMCHUNK * sizeof(c->mem[0]));
+	munmap(c->mem, c->memsize * sizeof(c->mem[0]));
+	c->mem = m;
+	c->memcore = 0;
+	c->memanon = 1;
+	tlbflush(c);
 }
 
+void
+nd10_loadmem(struct nd10 *c, int addr, unsigned short *w, int n)
+{
+	while (n-- > 0)
+		c->mem[addr++ & 0177777] = *w++;
+}
 
+/* console input read first, and where console output goes */
 void
-ormap(union ucent *uc, union ucent *ucb)
+nd10_setio(struct nd10 *c, FILE *in, FILE *out)
 {
-	switch (M_ORSPECS(uc)) {
-	case 0: return;
-	case 1: // ORBWO
-	case 3: // ORBW
-		M_LEVEL_W(ucb, (CAR >> 3) & 017);
-		if (M_OP(uc) == 1) { // interblock
-			if ((CAR & 7) == 2)
-				ucb->line = (ucb->line & ~15) | 016;
-			else if (CAR & 7)
-				ucb->line = (ucb->line & ~15) | (CAR & 7);
-			else
-				ucb->line = (ucb->line & ~15) | 010;
-		} else { // arith
-			if (CAR & 7)
-				ucb->line = (ucb->line & ~15) | (CAR & 7);
-			else
-				ucb->line = (ucb->line & ~15) | 010;
-		}
-		if (M_ORSPECS(uc) == 3) {
-			M_DEST_W(ucb, M_A(ucb));
-			if (M_OP(uc) == 1)
-				ucb->line = (ucb->line & ~15) | M_A(uc);
-		}
-		break;
+	c->ifd = in;
+	c->ofp = out;
+}
 
-	case 04: // ORSKP ARM
-		if (M_COND(uc) == 0) {
-			// set A and B
-			M_A_W(ucb, (IR >> 3) & 7);
-			M_B_W(ucb, (IR & 7) | (M_B(ucb) & 8));
-		}
-		M_TC_W(ucb, (IR >> 8) & 7);
-		break;
+void
+nd10_settape(struct nd10 *c, char *file)
+{
+	c->hname = file;
+}
 
-	case 05: // ORROP
-		M_A_W(ucb, (CAR >> 3) & 7);
-		M_DEST_W(ucb, (CAR & 7));
-		M_B_W(ucb, M_B(uc) & 010);
-		if (BIT6(CAR) == 0)
-			M_B_W(ucb, M_B(ucb) | (CAR & 7));
-		break;
+/* select an engine by its -e name */
+int
+nd10_setengine(struct nd10 *c, char *name)
+{
+	int i;
 
-	case 06: // ORSW2
-		if (M_COND(uc) == 0) {
-			M_A_W(ucb, (CAR >> 3) & 7);
-			M_B_W(ucb,  (M_B(uc) & 010) | (CAR & 7));
+	for (i = 0; i < E_BLOCK+1; i++)
+		if (strcmp(name, enames[i]) == 0) {
+			c->engine = i;
+			return 0;
 		}
-		M_DEST_W(ucb, (CAR & 7));
-		break;
+	return -1;
+}
 
-	case 07: // ORSW3
-		M_A_W(ucb, (CAR >> 3) & 7);
-		M_B_W(ucb, (M_B(uc) & 010) | (CAR & 7));
-		M_DEST_W(ucb, M_A(ucb));
-		break;
+int
+nd10_setclock(struct nd10 *c, char *name)
+{
+	long left;
+	int i;
 
-	default:
-		printf("\n");
-		errx(1, "ormap 0%o not implemented: %08X line %o", M_ORSPECS(uc), uc->line, mpc);
-	}
+	for (i = 0; i < K_TURBO+1; i++)
+		if (strcmp(name, knames[i]) == 0) {
+			left = rtcleft(c);
+			evcancel(c, rtc_int);
+			evcancel(c, rtc_pace);
+			c->kmode = i;
+			rtcsched(c, c->icount + left);
+			return 0;
+		}
+	return -1;
 }
 
-#define AMISS(x) if (uc->x) { printf("\n");	\
-	errx(1, "arith " #x " 0%o not implemented: %08X line %o", uc->x, uc->line, mpc); }
-
-char *anames[] = { "ZZ", " D", " P", " B", " L", " A", " T", " X",
-	" S", "DH", "XX", " H", "SR", " R", "SP", "SS" };
+/*
+ * 1 to execute the instructions natively (-n), 2 to check them in
+ * lockstep against the microcode in windows (-L), 3 to check all of
+ * them (-LL), 0 for the microcode alone.
+ */
+void
+nd10_setnative(struct nd10 *c, int on)
+{
+	c->native = on == 1 || on == 2;
+	c->lockstep = on >= 2 ? on - 1 : 0;
+}
 
-static int
-areg(union ucent *uc, int regno, int lvl)
+/*
+ * Run nsteps micro-steps and return the number of instructions
+ * fetched meanwhile, or -1 if the machine hit an error.
+ */
+long
+nd10_step(struct nd10 *c, long nsteps)
 {
-	int rv;
+	return nd10_run(c, nsteps, LONG_MAX);
+}
 
-	switch (regno) {
-	case 000: rv = 0; break;
-	case 001: rv = D[lvl]; break;
-	case 002: rv = CP; break;
-	case 003: rv = B[lvl]; break;
-	case 004: rv = L[lvl]; break;
-	case 005: rv = A[lvl]; break;
-	case 006: rv = T[lvl]; break;
-	case 007: rv = X[lvl]; break;
-
-	case 010: rv = STS[lvl]; break;
-	case 011: rv = SEXT8(H); break;
-	case 012: rv = 0; break;	// unused
-	case 013: rv = H; break;
-	case 014: rv = S1[lvl]; break;
-	case 015: rv = R; break;
-	case 016: rv = SP[lvl]; break;	// SP
-	case 017: rv = S2[lvl]; break;	// Scratch II
+/*
+ * As nd10_step, but stop after ninsns instructions (give or take the
+ * ones fetched in the last 1000 steps).
+ */
+long
+nd10_run(struct nd10 *c, long nsteps, long ninsns)
+{
+	sigjmp_buf jb;
+	volatile long left = nsteps;	// changed after the sigsetjmp
+	long n, k;
+
+	if (c->errmsg[0])
+		return -1;
+	n = c->icount;
+	c->ilimit = ninsns < LONG_MAX - c->icount ?
+	    c->icount + ninsns : LONG_MAX;
+	if (sigsetjmp(jb, 0)) {
+		c->errjb = NULL;
+		c->ilimit = LONG_MAX;
+		return -1;
 	}
-	if (tflag)
-		fprintf(tfp, " %s%02o(A)=%06o", anames[regno], lvl, rv);
-
-	Alatch[M_ARSEL(uc)] = rv;
-	return rv;
+	c->errjb = &jb;
+	for (; left > 0 && c->icount < c->ilimit; left -= k)
+		run(c, k = left < 1000 ? left : 1000);
+	c->errjb = NULL;
+	c->ilimit = LONG_MAX;
+	return c->icount - n;
 }
 
-static int
-breg(union ucent *uc, int lvl)
+/* Why the last nd10_run() returned -1 */
+char *
+nd10_error(struct nd10 *c)
 {
-	int rv;
-
-	switch (M_B(uc)) {
-	case 000: rv = 0; break;
-	case 001: rv = D[lvl]; break;
-	case 002: rv = CP; break;		// Current P
-	case 003: rv = B[lvl]; break;
-	case 004: rv = L[lvl]; break;
-	case 005: rv = A[lvl]; break;
-	case 006: rv = T[lvl]; break;
-	case 007: rv = X[lvl]; break;
-
-	case 011: rv = SH[M_ARSEL(uc)]; break;		// Shift reg
-	case 012:	// special case 2
-		rv = (1 << ((uc->line >> 12) & 017));
-		break;
-	case 013: rv = AC[M_ARSEL(uc)]; break;			// AC
-	case 014:
-		rv = AC[M_ARSEL(uc)] >> 1;
-		if (M_ARSEL(uc) == 0 && (AC[1] & 1))
-			rv |= 0100000;	// ACs connected in HAC
-		else if (M_ARSEL(uc))
-			rv |= (bC << 15);
-		break;						// 1/2 AC
-	case 015:
-		rv = AC[M_ARSEL(uc)] << 1;
-		if (M_ARSEL(uc))		// ACs connected in 2AC
-			rv |= (AC[0] >> 15);
-		break;						// 2*AC
+	return c->errmsg;
+}
 
-	default:
-		if (M_B(uc)) { printf("\n");	\
-		errx(1, "arith b 0%o not implemented: %08X line %o", M_B(uc), uc->line, mpc); }
-	}
-	if (tflag)
-		fprintf(tfp, " B=%06o", rv);
-	return rv; // XXX
+long
+nd10_icount(struct nd10 *c)
+{
+	return c->icount;
 }
 
-/* transfer to H reg, special 3 */
-static void
-tra(union ucent *uc)
+void
+nd10_destroy(struct nd10 *c)
 {
-	switch (M_B(uc)) {
-	case 001: H = STS[pil]; break;	// status reg
-	case 002: H = 0;		// OPR
-	case 003: H = 0; break;		// pgs
-	case 004: H = pvl;		// PVL
-	case 005:
-		H = iic;		// iic
-		iic = 0;
-		break;
+	ptrclose(c);
+	if (c->ifd)
+		fclose(c->ifd);
+	c->ifd = NULL;
+	c->tti_active = 0;
+	ttiset(c);
+	while (c->nsyms > 0)
+		free(c->syms[--c->nsyms].y_name);
+	free(c->syms);
+	munmap(c->mem, c->memsize * sizeof(c->mem[0]));
+	free(c);
+}
 
-	case 006: H = pid; break;	// pid
-	case 007: H = pie; break;	// pie
-	case 010: H = 0; break;		// cache status (0 == no cache)
-	case 011: H = (1 << pil); break;// dpil XXX
-	case 012: H = 0400; break;	// ALD
-	case 013: H = 0; break;		// pes
-	case 014: H = mpc+1; break;	// MPC to H
-	case 015: H = 0; break;		// pea
+/*
+ * Snapshots.  The file is a struct snapshot followed, at SNAPMEM, by
+ * the words of memory, so that a restore can map it directly; SNAPMEM
+ * is a multiple of the largest host page size.
+ * It is only valid for the same PROM and for this host.
+ *
+ * A snapshot is taken between two micro-steps, so mpc is the address
+ * of the next one; this is at the end of a fetch cycle or of a read of
+ * the console status, which is where the console loop waits.
+ */
+#define	SNAPMAGIC	"ND10SNP4"
+#define	SNAPMEM		65536
+
+struct snapshot {
+	char s_magic[8];
+	int s_promsz, s_promsum;
+	int s_mpc;
+	Rblk s_A, s_D, s_T, s_X, s_B, s_SP, s_L, s_S1, s_S2;
+	Reg s_CP, s_SH[2], s_Alatch[2], s_AC[2];
+	Reg s_H, s_R, s_CAR, s_PCR, s_ioreg, s_oldCP;
+	unsigned char s_STS[16];
+	int s_bZ, s_bO, s_bS, s_bC, s_bCl;
+	int s_pil, s_pid, s_pie, s_pvl, s_iic, s_iid, s_iie, s_SC;
+	int s_pgon, s_inton;
+	Reg s_pcr[16], s_ptab[4][64], s_pgs, s_pes, s_pea;
+	int s_pglock;
+	int s_rtc_doint, s_rtc_rft, s_rtc_ctr;
+	long s_icount;
+	int s_ttistat, s_tti_active, s_ttostat;
+	int s_ptr_char, s_ptr_intr, s_incnt;
+	long s_ptrpos;		/* -1 if no tape open, -2-pos if bulk */
+	long s_memsize;
+};
 
-	case 016: H = ioreg; break;	// IO to H
+static int
+promsum(struct nd10 *c)
+{
+	int i, sum = 0;
 
-	default:
-		if (M_B(uc)) { printf("\n");	\
-		errx(1, "arith b 0%o not implemented: %08X line %o", M_B(uc), uc->line, mpc); }
-	}
+	for (i = 0; i < c->promsz; i++)
+		sum = sum * 31 + c->rom[i].line;
+	return sum;
 }
 
+/* copy between the machine and s */
 static void
-trr(union ucent *uc, int aval)
+snapxfer(struct nd10 *c, struct snapshot *s, int save)
 {
-	switch (M_B(uc)) {
-	case 000: /* printf(" PAC=%06o", aval); */ break;
-	case 001: STS[pil] = aval; break;
-	case 002: /* printf(" LMP=%06o", aval); */ break;
-	case 003: PCR = aval; break;
-	case 004:
-		// Setting of bit 0-3 flips paging/interrupt (RS latch)
-		if (aval & 04) pgon = 0;
-		else if (aval & 010) pgon = 1;
-		if (aval & 01) inton = 0;
-		else if (aval & 02) inton = 1;
-		if (aval & 020) {
-		// Setting bit 4 sets MCALL D-ff (1058 1D), which in turn sets 
-		//  interrupt request ff (1058 13D)
-		// Clearing bit 4 clears the MCALL ff, but the interrupt request remains.
-		// Slightly different logic ic used here
-			int14(IIE_MC);
-		}
-		break;
-
-	case 005: iie = aval; break;
+#define	SNAPA(f) (save ? memcpy(s->s_##f, c->f, sizeof(s->s_##f)) : \
+	memcpy(c->f, s->s_##f, sizeof(s->s_##f)))
+#define	SNAPV(f) (save ? (s->s_##f = c->f) : (c->f = s->s_##f))
+	SNAPA(A); SNAPA(D); SNAPA(T); SNAPA(X); SNAPA(B);
+	SNAPA(SP); SNAPA(L); SNAPA(S1); SNAPA(S2);
+	SNAPA(SH); SNAPA(Alatch); SNAPA(AC); SNAPA(STS);
+	SNAPV(mpc); SNAPV(CP); SNAPV(H); SNAPV(R); SNAPV(CAR); SNAPV(PCR);
+	SNAPV(ioreg); SNAPV(oldCP);
+	SNAPV(bZ); SNAPV(bO); SNAPV(bS); SNAPV(bC); SNAPV(bCl);
+	SNAPV(pil); SNAPV(pid); SNAPV(pie); SNAPV(pvl);
+	SNAPV(iic); SNAPV(iid); SNAPV(iie); SNAPV(SC);
+	SNAPV(pgon); SNAPV(inton);
+	SNAPA(pcr); SNAPA(ptab);
+	SNAPV(pgs); SNAPV(pes); SNAPV(pea); SNAPV(pglock);
+	SNAPV(rtc_doint); SNAPV(rtc_rft); SNAPV(icount);
+	if (save)		// fetches left to the tick, as it was kept
+		s->s_rtc_ctr = rtcleft(c) - 1;
+	else
+		rtcsched(c, c->icount + 1 + s->s_rtc_ctr);
+	SNAPV(ttistat); SNAPV(tti_active); SNAPV(ttostat);
+	SNAPV(ptr_char); SNAPV(ptr_intr); SNAPV(incnt);
+}
 
-	case 006: pid = aval; break;
-	case 007: pie = aval; break;
+/*
+ * Save the machine to file, with mpc as the next micro-step.
+ * Written to a temporary file first, since memory may be mapped
+ * from the old one.
+ */
+int
+nd10_save(struct nd10 *c, char *file)
+{
+	struct snapshot s;
+	char tmp[PATH_MAX];
+	FILE *fp;
+	long i;
+	int rv = 0;
+
+	memset(&s, 0, sizeof(s));
+	memcpy(s.s_magic, SNAPMAGIC, sizeof(s.s_magic));
+	s.s_promsz = c->promsz;
+	s.s_promsum = promsum(c);
+	snapxfer(c, &s, 1);
+	s.s_ptrpos = c->ptrimg == NULL ? -1 :
+	    c->ptrfast ? -2 - c->ptrpos : c->ptrpos;
+	s.s_memsize = c->memsize;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return -1;
+	if (fwrite(&s, sizeof(s), 1, fp) != 1)
+		rv = -1;
+	for (i = 0; rv == 0 && i < c->memsize; i += MEMCHUNK)
+		if (!memzero(c, i) &&
+		    (fseek(fp, SNAPMEM + i * sizeof(c->mem[0]), SEEK_SET) < 0 ||
+		    fwrite(c->mem + i, sizeof(c->mem[0]), MEMCHUNK,
+		    fp) != MEMCHUNK))
+			rv = -1;
+	if (fflush(fp) == EOF ||
+	    ftruncate(fileno(fp), SNAPMEM + c->memsize * sizeof(c->mem[0])) < 0)
+		rv = -1;
+	if (fclose(fp) == EOF || rv < 0 || rename(tmp, file) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
 
-	case 013: CAR = aval; break;
-	case 014:
-		H = CAR = aval;
-		if (dfp)
-			dprint();
-		mpc = epg(IR, 0)-1; // writing to IR resets MPC
-		break;
+/*
+ * Restore a machine saved by nd10_save.  The PROM must be loaded and
+ * a tape that was being read attached (nd10_settape) first.
+ */
+int
+nd10_restore(struct nd10 *c, char *file)
+{
+	struct snapshot s;
+	unsigned short *m;
+	FILE *fp;
 
-	case 015: break; // XXX unused???
+	if ((fp = fopen(file, "r")) == NULL)
+		return -1;
+	if (fread(&s, sizeof(s), 1, fp) != 1 ||
+	    memcmp(s.s_magic, SNAPMAGIC, sizeof(s.s_magic)) ||
+	    s.s_promsz != c->promsz || s.s_promsum != promsum(c)) {
+		fclose(fp);
+		errno = EINVAL;
+		return -1;
+	}
+	if (c->memcore && s.s_memsize != c->memsize) {
+		fclose(fp);
+		errno = EINVAL;
+		return -1;
+	}
+	m = mmap(NULL, s.s_memsize * sizeof(c->mem[0]), PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE, fileno(fp), SNAPMEM);
+	fclose(fp);
+	if (m == MAP_FAILED)
+		return -1;
+	if (c->memcore) {		// the snapshot goes into the core file
+		memcpy(c->mem, m, c->memsize * sizeof(c->mem[0]));
+		munmap(m, c->memsize * sizeof(c->mem[0]));
+	} else {
+		munmap(c->mem, c->memsize * sizeof(c->mem[0]));
+		c->mem = m;
+		c->memsize = s.s_memsize;
+		c->memanon = 0;
+	}
+	snapxfer(c, &s, 0);
+	tlbflush(c);
+	intcalc(c);
+	ttiset(c);
+	ptrclose(c);
+	if (s.s_ptrpos != -1 && c->hname) {
+		if (ptropen(c) < 0)
+			return -1;
+		if (s.s_ptrpos < -1) {
+			ptrbulk(c, 0);
+			s.s_ptrpos = -2 - s.s_ptrpos;
+		}
+		c->ptrpos = s.s_ptrpos;
+	}
+	return 0;
+}
 
-	case 016:
-		ioreg = aval;
-		if ((CAR & 0174000) == 0164000)
-			ioexec(uc);
-		else if ((CAR & 0177700) == 0143600)
-			ident(uc);
-		else printf("ioreg! IR %06o\r\n", IR);
-		break;
+/*
+ * Checkpoints (-c).  When the instruction count or CP given is reached
+ * the process forks once for each -a input, so every continuation
+ * starts from the same state with memory shared copy-on-write.  A
+ * continuation reads its console input from its file, writes its
+ * console output to file.out and ends when the guest halts (WAIT with
+ * interrupts off) or after -x instructions.  The original process
+ * waits for them and exits.
+ */
+static void
+checkpoint(struct nd10 *c)
+{
+	struct timespec t1;
+	char buf[PATH_MAX];
+	pid_t *pids;
+	int i, st, nfail = 0;
+
+	if (c->ckarm == 2) {
+		if (c->icount - c->ckinsn >= c->xinsn)
+			ckend(c, "stopped");
+		else if ((c->IR & 0177400) == 0151000 && c->inton == 0)
+			ckend(c, "halted");
+		else if ((c->IR & 0177400) == 0151000 && c->pil == 0 &&
+		    c->pkl == 0 &&
+		    ckstuck(c, 0))
+			ckend(c, "waits for input");
+		return;
+	}
+	if (c->icount != c->ckinsn && c->oldCP != c->ckpc)
+		return;
 
-	default:
-		printf("\n");
-		errx(1, "trr 0%o not implemented: %08X line %o", M_B(uc), uc->line, mpc);
+	c->ckarm = 0;
+	c->ckinsn = c->icount;
+	fprintf(stderr, "checkpoint at instruction %ld, CP %06o\n",
+	    c->icount, c->oldCP);
+	if ((pids = calloc(c->altc, sizeof(pid_t))) == NULL)
+		err(1, "calloc");
+	fflush(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &c->ckt0);
+	for (i = 0; i < c->altc; i++) {
+		if ((pids[i] = fork()) < 0)
+			err(1, "fork");
+		if (pids[i] > 0)
+			continue;
+		coreprivate(c);
+		if (c->ifd)
+			fclose(c->ifd);
+		if ((c->ifd = fopen(c->altv[i], "r")) == NULL)
+			err(1, "%s", c->altv[i]);
+		snprintf(buf, sizeof(buf), "%s.out", c->altv[i]);
+		if ((c->ofp = fopen(buf, "w")) == NULL)
+			err(1, "%s", buf);
+		c->sfd = -1;
+		c->recfp = NULL;	// the log is of the original run
+		c->ckarm = 2;
+		c->altn = i;
+		ttiset(c);	// the new input may want level 12
+		return;
+	}
+	for (i = 0; i < c->altc; i++) {
+		waitpid(pids[i], &st, 0);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+			fprintf(stderr, "%s: failed\n", c->altv[i]);
+			nfail++;
+		}
 	}
+	fprintf(stderr, "%d continuations in %.3fs, %d failed\n", c->altc,
+	    (t1.tv_sec - c->ckt0.tv_sec) + (t1.tv_nsec - c->ckt0.tv_nsec) / 1e9,
+	    nfail);
+	exit(nfail != 0);
 }
 
-char *dnames[] = { "ZZ", " D", " P", " B", " L", " A", " T", " X",
-	" S", "SH", "XX", "SC", "SR", "YY", "SP", "SS" };
+/*
+ * Input log (-R, -P).  Guest execution depends on the host only
+ * through the results of the console and tape input IOX, so these are
+ * numbered and written to the log with the instruction count they were
+ * done at; status reads only when the status changes.  Several may be
+ * done at the same count since the console microcode polls without
+ * fetching.  A replay returns the logged results at the same points
+ * and checks that the run has not diverged.  Whether the console has
+ * input for its interrupt is logged as device TTILINE, see ttiready().
+ */
+#define	INSTAT(d)	((d) == 0302 ? 0 : (d) == 0402 ? 1 : (d) == TTILINE ? 2 : -1)
 
 static void
-setdreg(union ucent *uc, int dval, int lvl)
+inlog(struct nd10 *c, int dev)
 {
-	if (tflag)
-		fprintf(tfp, ": D=%06o in %s%02o", dval, dnames[M_DEST(uc)], lvl);
-	switch (M_DEST(uc)) {
-	case 001: D[lvl] = dval; break;		// D
-	case 002: CP = dval; break;		// Current P
-	case 003: B[lvl] = dval; break;		// B
-	case 004: L[lvl] = dval; break;		// L
-	case 005: A[lvl] = dval; break;		// A
-	case 006: T[lvl] = dval; break;		// T
-	case 007: X[lvl] = dval; break;		// X
-	case 010: STS[lvl] = dval; break;	// Status
-	case 011: SH[M_ARSEL(uc)] = dval; break;		// Shift reg
-	case 013:				// Shift counter
-		SC = dval & 077;
-		if (SC > 037) SC |= (0xffffffff << 6);
-		break;
-	case 014: S1[lvl] = dval; break;	// Scratch I
-	case 016: SP[lvl] = dval; break;	// Saved P
-	case 017: S2[lvl] = dval; break;	// Scratch II
+	int i = INSTAT(dev);
 
-	default:
-		if (M_DEST(uc)) { printf("\n");	\
-		errx(1, "arith dest 0%o not implemented: %08X line %o", M_DEST(uc), uc->line, mpc); }
+	if (i >= 0) {
+		if (c->inlast[i] == c->ioreg) {
+			c->niox++;
+			return;
+		}
+		c->inlast[i] = c->ioreg;
 	}
+	fprintf(c->recfp, "%ld %ld %o %o\n", c->niox++, c->icount, dev,
+	    c->ioreg);
+	fflush(c->recfp);
 }
 
-int
-ckcond(union ucent *uc)
+static void
+plread(struct nd10 *c)
 {
-	int n;
-
-	if (M_JCOND(uc) == 0)
-		return 1; // no test condition
-	switch (M_JTC(uc) & 03) {
-	case 0: /* eql */ n = bZ; break;
-	case 1: /* geq */ n = bS == 0; break;
-	case 2: /* gre */ n = (bS ^ bO) == 0; break;
-	case 3: /* mgre */ n = bC; break;
+	if (fscanf(c->playfp, "%ld %ld %o %o", &c->pl_n, &c->pl_insn,
+	    &c->pl_dev,
+	    &c->pl_val) != 4) {
+		c->pl_n = -1;
+		c->inlast[0] = c->inlast[1] = c->inlast[2] = 0;
 	}
-	if (M_JTC(uc) & 04)
-		n = !n;
-	return n;
 }
 
-int
-alu(union ucent *uc, Reg aval, Reg bval, int most)
+static void
+inplay(struct nd10 *c, int dev)
 {
-	int c_o, dval;
-	int c = (STS[pil] & STS_C) != 0;
-	Reg negA = ~aval;
+	if (c->pl_n == c->niox) {
+		if (c->pl_dev != dev || c->pl_insn != c->icount)
+			uerrx(c, "replay diverged at input %ld, instruction %ld"
+			    " (logged IOX %o at %ld)", c->niox, c->icount,
+			    c->pl_dev, c->pl_insn);
+		c->ioreg = c->pl_val;
+		if (INSTAT(dev) >= 0)
+			c->inlast[INSTAT(dev)] = c->pl_val;
+		plread(c);
+		if (c->pl_n < 0)
+			fprintf(stderr, "end of input log at instruction %ld\n",
+			    c->icount);
+	} else if (INSTAT(dev) >= 0) {
+		c->ioreg = c->inlast[INSTAT(dev)];
+	} else if (c->pl_n >= 0)
+		uerrx(c, "replay diverged at input %ld, instruction %ld",
+		    c->niox, c->icount);
+	c->niox++;
+}
 
-	if (most && M_OP(uc) == 3)
-		c = bCl; // combined
+/* take the snapshot asked for by a signal, or just exit */
+static void
+snapshot(struct nd10 *c)
+{
+	int ex = snapreq == 2;
+
+	snapreq = 0;
+	c->mpc++;		// the step being executed is done
+	if (c->snapname && nd10_save(c, c->snapname) < 0)
+		warn("%s", c->snapname);
+	c->mpc--;
+	if (ex)
+		exit(0);
+}
 
-	switch (M_ALU(uc)) {
-	case 000: dval = bval - 1; break;		// BM1
-	case 001: dval = aval + bval; break;		// PLUS XXX
-	case 002: dval = bval + negA; break;		// BMAM1 (B-A-1)
-	case 003: dval = bval; break;			// BDI
+/*
+ * Split a microinstruction word into its fields.
+ */
+static void
+udecode(struct ucdec *ud, int line)
+{
+	union ucent ucs, *uc = &ucs;
+
+	uc->line = line;
+	ud->line = line;
+	ud->op = M_OP(uc);
+	ud->alu = M_ALU(uc);
+	ud->a = M_A(uc);
+	ud->b = M_B(uc);
+	ud->dest = M_DEST(uc);
+	ud->cycle = M_CYCLE(uc);
+	ud->orspecs = M_ORSPECS(uc);
+	ud->level = M_LEVEL(uc);
+	ud->tc = M_TC(uc);
+	ud->cond = M_COND(uc);
+	ud->arsel = M_ARSEL(uc);
+	ud->chlev = M_CHLEV(uc);
+	ud->ssave = M_SSAVE(uc);
+	ud->priv = M_PRIV(uc);
+	ud->car = M_CAR(uc);
+	ud->addr = M_ADDR(uc);
+
+	ud->lalt = M_LALT(uc);
+	ud->endid = M_ENDID(uc);
+	ud->term = M_TERM(uc);
+	ud->lb = M_LB(uc);
+	ud->tg = M_TG(uc);
+	ud->lm = M_LM(uc);
+	ud->lsh32 = M_LSH32(uc);
+	ud->lsht = M_LSHT(uc);
+	ud->lshr = M_LSHR(uc);
+	ud->lorsht = M_LORSHT(uc);
+	ud->lalul = M_LALUL(uc);
+}
 
-	case 005: dval = bval + aval + c; break;	// PLUS ADDC
-	case 006: dval = bval + negA + c; break;	// BMAM1 ADDC (B-A-1)+C
+/*
+ * Only the fields that words of its op use, taken from the raw word
+ * when executed as the code before udecode() did; only for -B.  The
+ * rest of ud is left as it was.
+ */
+static void
+udecuse(struct ucdec *ud, int line)
+{
+	union ucent ucs, *uc = &ucs;
+
+	uc->line = line;
+	ud->line = line;
+	ud->op = M_OP(uc);
+	switch (ud->op) {
+	case 0:
+	case 1:
+		ud->alu = M_ALU(uc);
+		ud->a = M_A(uc);
+		ud->b = M_B(uc);
+		ud->dest = M_DEST(uc);
+		ud->cycle = M_CYCLE(uc);
+		ud->orspecs = M_ORSPECS(uc);
+		ud->level = M_LEVEL(uc);
+		ud->tc = M_TC(uc);
+		ud->cond = M_COND(uc);
+		ud->arsel = M_ARSEL(uc);
+		ud->chlev = M_CHLEV(uc);
+		ud->ssave = M_SSAVE(uc);
+		break;
+	case 2:
+		ud->tc = M_JTC(uc);
+		ud->cond = M_JCOND(uc);
+		ud->priv = M_PRIV(uc);
+		ud->car = M_CAR(uc);
+		ud->addr = M_ADDR(uc);
+		break;
+	case 3:
+		ud->alu = M_LALUM(uc);
+		ud->ssave = M_LSSAVE(uc);
+		ud->lalt = M_LALT(uc);
+		ud->endid = M_ENDID(uc);
+		ud->term = M_TERM(uc);
+		ud->lb = M_LB(uc);
+		ud->tg = M_TG(uc);
+		ud->lm = M_LM(uc);
+		ud->lsh32 = M_LSH32(uc);
+		ud->lsht = M_LSHT(uc);
+		ud->lshr = M_LSHR(uc);
+		ud->lorsht = M_LORSHT(uc);
+		ud->lalul = M_LALUL(uc);
+		break;
+	}
+}
 
-	case 011: dval = aval + bval; break;		// PLUS
+/*
+ * Microcode trace (-t).  Each micro-step is collected in trcur and put
+ * in a ring buffer that a thread writes to tfp, so the machine only
+ * stalls if the writer falls a whole ring behind.  The ring has a
+ * single producer and consumer and needs no lock.
+ */
+#define	TRSIZE	65536		/* records, a power of 2 */
 
-	case 015: dval = aval + bval + 1; break;	// PLUS + 1
-	case 016: dval = bval + negA + 1; break;	// BMINA (B-A)
-	case 017: dval = bval + 1; break;		// BDI ADD1
-	case 020: dval = ~bval; break;			// BDIRC
+static struct trrec trring[TRSIZE];
+static atomic_ulong trhead, trtail;
+#ifndef LIBND10
+static atomic_int trstop;
+static pthread_t trthr;
+static pid_t trpid;
+#endif
 
-	case 022: dval = aval | ~bval; break;		// ORCB
+static void
+trput(struct trrec *r)
+{
+	unsigned long h = atomic_load_explicit(&trhead, memory_order_relaxed);
 
-	case 024: dval = ~(aval|bval); break;		// ORC
-	case 025: dval = ~aval; break;			// ADIRC
+	while (h - atomic_load_explicit(&trtail, memory_order_acquire) ==
+	    TRSIZE)
+		sched_yield();
+	trring[h & (TRSIZE-1)] = *r;
+	atomic_store_explicit(&trhead, h + 1, memory_order_release);
+}
 
-	case 030: dval = aval & ~bval; break;		// ANCB
-	case 031: dval = aval ^ bval; break;		// EXOR
-	case 032: dval = aval; break;			// ADIR
-	case 033: dval = aval | bval; break;		// AND
+static void
+trend(struct nd10 *c)
+{
+	trcur.t_R = c->R;
+	trcur.t_H = c->H;
+	trput(&trcur);
+	trbusy = 0;
+}
 
-	case 035: dval = ~aval & bval; break;		// ANDCA
-	case 036: dval = aval & bval; break;		// AND
-	case 037: dval = bval; break;			// BDIR
+/* only native batches do more than one IOX in a step */
+static void
+triox(int dev)
+{
+	struct trrec x;
 
-	default:
-		{ printf("\n"); \
-		errx(1, "alu 0%o not implemented: %08X line %o", M_ALU(uc), uc->line, mpc); }
+	if (trcur.t_flags & TR_IOX) {
+		memset(&x, 0, sizeof(x));
+		x.t_flags = TR_XIOX;
+		x.t_iox = dev;
+		trput(&x);
+		return;
 	}
+	trcur.t_flags |= TR_IOX | (trcur.t_flags & TR_CYC ? TR_IOXC : 0);
+	trcur.t_iox = dev;
+}
 
-	if (most) {
-		if (M_ALU(uc) == 016 || M_ALU(uc) == 002 || M_ALU(uc) == 006)
-			aval = negA;
-		bZ = ((dval & 0177777) == 0);
-		bO = (!BIT15(bval ^ aval) && BIT15(bval ^ dval));
-		bS = BIT15(dval);
-		bC = dval > 0177777;
-	} else
-		bCl = dval > 0177777;
+#ifndef LIBND10	/* the writer is started by main() */
+static void *
+trwriter(void *arg)
+{
+	FILE *fp = arg;		// no machine in this thread
+	struct timespec ts = { 0, 1000000 };
+	unsigned long h, t = 0;
+	size_t n;
+	int stop;
 
-	if (M_SSAVE(uc)) {
-		STS[pil] &= ~(STS_C|STS_Q);
-		if (bC) STS[pil] |= STS_C;
-		if (bO) STS[pil] |= (STS_O|STS_Q);
+	for (;;) {
+		stop = atomic_load_explicit(&trstop, memory_order_acquire);
+		h = atomic_load_explicit(&trhead, memory_order_acquire);
+		if (h == t) {
+			if (stop)
+				break;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		n = h - t;
+		if (n > TRSIZE - (t & (TRSIZE-1)))
+			n = TRSIZE - (t & (TRSIZE-1));
+		if (fwrite(&trring[t & (TRSIZE-1)], sizeof(struct trrec), n,
+		    fp) != n)
+			err(1, "trace");
+		t += n;
+		atomic_store_explicit(&trtail, t, memory_order_release);
 	}
+	fflush(fp);
+	return NULL;
+}
 
-	return dval & 0177777;
+/* put a step that ends the program and wait for the writer */
+static void
+trclose(void)
+{
+	struct nd10 *c = mainc;
+
+	if (getpid() != trpid)
+		return;
+	if (trbusy)
+		trend(c);
+	atomic_store_explicit(&trstop, 1, memory_order_release);
+	pthread_join(trthr, NULL);
 }
 
-int
-calcea(void)
+/* the writer is not in a forked child, so no trace there */
+static void
+trfork(void)
 {
-	int ea;
+	if (mainc)
+		mainc->tflag = 0;
+}
 
-	if ((IR & 0174000) == 0130000) {
-		ea = SEXT8(IR) + oldCP;
-	} else {
-		ea = BIT8(IR) ? B[pil] : oldCP;
-		if (BIT10(IR) & !BIT9(IR) & !BIT8(IR))
-			ea = 0;
-		ea += SEXT8(IR);
-		if (BIT9(IR))
-			ea = mem[ea & 0177777];
-		if (BIT10(IR))
-			ea += X[pil];
-	}
-	return ea & 0177777;
+static void
+trinit(struct nd10 *c)
+{
+	trpid = getpid();
+	if ((errno = pthread_create(&trthr, NULL, trwriter, c->tfp)) != 0)
+		err(1, "pthread_create");
+	atexit(trclose);
+	pthread_atfork(NULL, NULL, trfork);
 }
+#endif
 
-void
-cycles(union ucent *uc, int aval)
+/*
+ * Console of the main program.  A thread reads the terminal into conin
+ * and writes conout to ofp, so the machine makes no system calls for the
+ * console.  Output is written at the end of a line, when the guest
+ * idles, when it has stopped coming for CONMS or when half the ring is
+ * used.  As for the trace, the rings need no lock; conmx and concv only
+ * let idle() sleep until there is input.
+ */
+#define	CONSIZE	65536		/* characters, a power of 2 */
+#define	CONMS	5		/* ms between looks at conout */
+
+static struct conring {
+	unsigned char c_buf[CONSIZE];
+	atomic_ulong c_head, c_tail;
+} conin, conout;
+static atomic_int conflush, coneof;
+static int conon;		/* the thread runs */
+static struct nd10 *_Atomic conirq;	/* interrupted on input, see ttiset() */
+static pthread_mutex_t conmx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t concv;
+#ifndef LIBND10
+static atomic_int constop;
+static int confd;
+static pthread_t conthr;
+static pid_t conpid;
+#endif
+
+static int
+conlen(struct conring *r)
 {
-	int n;
+	return atomic_load_explicit(&r->c_head, memory_order_acquire) -
+	    atomic_load_explicit(&r->c_tail, memory_order_acquire);
+}
 
-	if (M_CYCLE(uc) == 0)
-		return;
-	if (tflag)
-		fprintf(tfp, " cycle in adr %o ", mem[052744]);
+/* the producer side, 0 if full */
+static int
+conput(struct conring *r, int c)
+{
+	unsigned long h = atomic_load_explicit(&r->c_head,
+	    memory_order_relaxed);
+
+	if (h - atomic_load_explicit(&r->c_tail, memory_order_acquire) ==
+	    CONSIZE)
+		return 0;
+	r->c_buf[h & (CONSIZE-1)] = c;
+	atomic_store_explicit(&r->c_head, h + 1, memory_order_release);
+	return 1;
+}
 
-	switch (M_CYCLE(uc)) {
-	case 01:				// CEATR
-		R = calcea();
-		break;
+/* the consumer side, -1 if empty */
+static int
+conget(struct conring *r)
+{
+	unsigned long t = atomic_load_explicit(&r->c_tail,
+	    memory_order_relaxed);
+	int c;
+
+	if (atomic_load_explicit(&r->c_head, memory_order_acquire) == t)
+		return -1;
+	c = r->c_buf[t & (CONSIZE-1)];
+	atomic_store_explicit(&r->c_tail, t + 1, memory_order_release);
+	return c;
+}
 
-	case 02: R = CP; break;			// CPTR
+static void
+conputc(int c)
+{
+	while (conput(&conout, c) == 0)
+		sched_yield();		// the thread is a ring behind
+	if (c == '\n')
+		atomic_store_explicit(&conflush, 1, memory_order_release);
+}
 
-	case 03:				// CFC
-		// 1) check if pending interrupts.
-		// 2) Fetch instrction
-		// 3) Ensure mpc is within memory space
-		n = pk_calc();
-		if (inton && pil != n) {
-			mpc = 0400 - 1;
-		} else {
-			H = CAR = mem[CP];
-			oldCP = CP++;
-			if (dfp)
-				dprint();
-			if (inton == 0 && (IR & 0177400) == 0151000)
-				mpc = -1; // stop
-			else
-				mpc = epg(IR, 0)-1;		
-			// mpc will be incremented before next micro insn
-			if (mpc > promsz-1) { // Illegal instruction
-				int14(IIE_II);
-				if (inton && pil != pk_calc())
-					mpc = 0400 - 1;
-			}
-		if (rtc_ctr-- == 0) {
-			rtc_int();
-			rtc_ctr = 10000;
+#ifndef LIBND10	/* the thread is started by main() */
+static void *
+conthread(void *arg)
+{
+	FILE *fp = arg;		// no machine in this thread
+	struct nd10 *m;
+	unsigned char buf[CONSIZE];
+	struct pollfd pfd;
+	unsigned long h, oh = 0;
+	int c, i, n, stop;
+
+	for (;;) {
+		stop = atomic_load_explicit(&constop, memory_order_acquire);
+		n = CONSIZE - conlen(&conin);
+		pfd.fd = atomic_load(&coneof) ? -1 : confd;
+		pfd.events = n ? POLLIN : 0;
+		pfd.revents = 0;
+		if (!stop)
+			poll(&pfd, 1, CONMS);
+		if (n && pfd.revents) {
+			if ((n = read(confd, buf, n)) == 0 ||
+			    (n < 0 && errno != EAGAIN && errno != EINTR))
+				atomic_store(&coneof, 1);
+			for (i = 0; i < n; i++)
+				conput(&conin, buf[i]);
+			if (n > 0 && (m = atomic_load(&conirq)) != NULL)
+				ttiwake(m);
+			pthread_mutex_lock(&conmx);
+			pthread_cond_signal(&concv);
+			pthread_mutex_unlock(&conmx);
 		}
+		h = atomic_load_explicit(&conout.c_head, memory_order_acquire);
+		if (conlen(&conout) && (stop || h == oh ||
+		    atomic_exchange(&conflush, 0) ||
+		    conlen(&conout) >= CONSIZE/2)) {
+			while ((c = conget(&conout)) >= 0)
+				putc(c, fp);
+			fflush(fp);
 		}
-		break;
+		oh = h;
+		if (stop)
+			break;
+	}
+	return NULL;
+}
 
-	// Write cycle: A goes to IB which is written to memory.
-	case 04:
-		mem[++R] = aval;
-		break;				// CWR1
-	case 05:				// CW
-		R = calcea();
-		mem[R] = aval;
-		break;
+/* write what is left */
+static void
+conclose(void)
+{
+	if (getpid() != conpid)
+		return;
+	atomic_store_explicit(&constop, 1, memory_order_release);
+	pthread_join(conthr, NULL);
+}
 
-	case 06: H = mem[++R]; break;		// CRR1
-	case 07:
-		R = calcea();
-		H = mem[R];
-		break;				// CR
+/* the thread is not in a forked child */
+static void
+confork(void)
+{
+	conon = 0;
+	atomic_store(&conirq, NULL);
+}
 
-	default: ;
+static void
+coninit(struct nd10 *c)
+{
+	pthread_condattr_t ca;
+
+	confd = c->sfd;
+	if (c->sfd < 0)
+		atomic_store(&coneof, 1);
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&concv, &ca);
+	conpid = getpid();
+	if ((errno = pthread_create(&conthr, NULL, conthread, c->ofp)) != 0)
+		err(1, "pthread_create");
+	conon = 1;
+	atexit(conclose);
+	pthread_atfork(NULL, NULL, confork);
+}
+#endif
+
+/*
+ * In a continuation the input ends with its -a file, so a guest that
+ * waits for more with the RTC interrupt off will wait for ever.  polls
+ * if it reads the console status, else it waits for an interrupt.
+ */
+static int
+ckstuck(struct nd10 *c, int polls)
+{
+	int ch;
+
+	if (c->ckarm != 2 || (c->inton && c->rtc_doint))
+		return 0;
+	if (!polls && !BIT0(c->tti_active))
+		return 1;
+	if (conon && conlen(&conin))
+		return 0;
+	if (c->ifd && (ch = getc(c->ifd)) != EOF) {
+		ungetc(ch, c->ifd);
+		return 0;
 	}
-	if (tflag)
-		fprintf(tfp, " cycle %o R=%o adr %o ", M_CYCLE(uc), R, mem[052744]);
+	return 1;
 }
 
-void
-arith(union ucent *uc)
+static void
+ckend(struct nd10 *c, char *why)
 {
-	int aval, bval;
-	int dval;
-	int arsel = M_ARSEL(uc);
-	int true;
-	union ucent ucs, *ucb = &ucs;
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "%s: %s after %ld insns, %.3fs\n", c->altv[c->altn],
+	    why,
+	    c->icount - c->ckinsn, (t1.tv_sec - c->ckt0.tv_sec) +
+	    (t1.tv_nsec - c->ckt0.tv_nsec) / 1e9);
+	exit(0);
+}
+
+/*
+ * Flight recorder.  The last FRINSNS instructions fetched, with the
+ * registers of the level at the fetch, and the last FRSTEPS microcode
+ * addresses run are always kept, so that there is something to look
+ * at after a microcode error.  The block engine records a superblock
+ * as its first word, and instructions run natively have no micro-steps.
+ */
+static inline void
+frinsn(struct nd10 *c)
+{
+	struct frinsn *f = &c->frins[c->frin++ & (FRINSNS-1)];
+
+	f->f_icount = c->icount;
+	f->f_cp = c->oldCP;
+	f->f_ir = c->IR;
+	f->f_a = c->A[c->pil];
+	f->f_d = c->D[c->pil];
+	f->f_t = c->T[c->pil];
+	f->f_x = c->X[c->pil];
+	f->f_b = c->B[c->pil];
+	f->f_l = c->L[c->pil];
+	f->f_sts = c->STS[c->pil];
+	f->f_pil = c->pil;
+}
 
-	int spec1 = M_DEST(uc) == 012;
-	int spec2 = M_B(uc) == 012;
-	int spec3 = M_A(uc) == 012;
+static void
+frdump(struct nd10 *c, char *why)
+{
+	FILE *fp = c->frfp ? c->frfp : stderr;
+	char *nl = isatty(fileno(fp)) ? "\r\n" : "\n";	// raw tty
+	struct frinsn *f;
+	unsigned int i, n;
+	char sym[40];
+
+	fprintf(fp, "flight recorder: %s at instruction %ld%s",
+	    why, c->icount, nl);
+	n = c->frin < FRINSNS ? c->frin : FRINSNS;
+	for (i = c->frin - n; i != c->frin; i++) {
+		f = &c->frins[i & (FRINSNS-1)];
+		fprintf(fp, "%10ld %06o: %06o  A=%06o D=%06o T=%06o X=%06o "
+		    "B=%06o L=%06o STS=%03o lvl %d", f->f_icount, f->f_cp,
+		    f->f_ir, f->f_a, f->f_d, f->f_t, f->f_x, f->f_b, f->f_l,
+		    f->f_sts, f->f_pil);
+		if (c->nsyms && symname(c, f->f_cp, sym, sizeof(sym)))
+			fprintf(fp, " <%s>", sym);
+		fputs(nl, fp);
+	}
+	n = c->frun < FRSTEPS ? c->frun : FRSTEPS;
+	for (i = c->frun - n; i != c->frun; i++)
+		fprintf(fp, "  %04o: %08X%s", c->frmpc[i & (FRSTEPS-1)],
+		    c->rom[c->frmpc[i & (FRSTEPS-1)]].line, nl);
+	fflush(fp);
+}
 
-	*ucb = *uc;
-	ormap(uc, ucb);
-	aval = areg(ucb, M_A(ucb), pil);
+static void
+frsig(struct nd10 *c)
+{
+	frreq = 0;
+	frdump(c, "SIGUSR1");
+}
 
-	if (spec3) {
-		if (M_B(ucb) == 017)
-			M_B_W(ucb, IR & 15);
-		tra(ucb);
-		return;
+/*
+ * Microcode error: the message is left for nd10_error().  Inside
+ * nd10_run() that returns -1; elsewhere the library reports it on
+ * stderr and the next nd10_run() fails, and the program dumps the
+ * recorder and exits.
+ */
+static void
+uerrx(struct nd10 *c, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(c->errmsg, sizeof(c->errmsg), fmt, ap);
+	va_end(ap);
+	if (c->errjb)
+		siglongjmp(*c->errjb, 1);
+#ifdef LIBND10
+	warnx("%s", c->errmsg);
+#else
+	printf("\n");		// end the console line
+	frdump(c, "error");
+	errx(1, "%s", c->errmsg);
+#endif
+}
+
+/*
+ * Guest profile (-G).  Every instruction fetched is counted in a call
+ * tree, at its address under the routines it was called through, and
+ * by its microcode entry point.  Calls are taken to be JPL and returns
+ * EXIT; the return address of each call is kept so that an EXIT that
+ * returns past several calls unwinds them all, and one that does not
+ * go to any of them leaves the stack as it is.  Each interrupt level
+ * has its own call stack.
+ */
+#define	GDEPTH	256		/* calls followed per level */
+#define	G_JPL	1
+#define	G_EXIT	2
+
+struct gnode {
+	int g_parent;		/* -1 for the root of a level */
+	int g_addr;		/* routine or instruction address, or level */
+	int g_leaf;		/* an instruction, not a routine */
+	unsigned long g_n;	/* fetched, for instructions */
+};
+
+struct gprofile {
+	struct gnode *nodes;
+	int nnodes, anodes;
+	int *hash, hsize;	/* nodes by parent and address */
+	int cur[16];		/* current routine per level */
+	int pend[16], ret[16];	/* call or return just done */
+	struct gframe {
+		int f_node, f_ret;
+	} stk[16][GDEPTH];
+	int depth[16];
+	unsigned long ops[4096];	/* by microcode entry */
+};
+
+static unsigned int
+ghash(int parent, int addr, int leaf)
+{
+	return ((unsigned)parent * 0x9E3779B1u) ^ (addr << 1) ^ leaf;
+}
+
+/* find or make the node */
+static int
+gnode(struct gprofile *g, int parent, int addr, int leaf)
+{
+	unsigned int h;
+	struct gnode *n;
+	int i;
+
+	if (g->nnodes * 2 >= g->hsize) {	// grow the hash
+		free(g->hash);
+		g->hsize *= 2;
+		if ((g->hash = malloc(g->hsize * sizeof(int))) == NULL)
+			err(1, "malloc");
+		memset(g->hash, -1, g->hsize * sizeof(int));
+		for (i = 0; i < g->nnodes; i++) {
+			n = &g->nodes[i];
+			h = ghash(n->g_parent, n->g_addr, n->g_leaf);
+			while (g->hash[h & (g->hsize-1)] >= 0)
+				h++;
+			g->hash[h & (g->hsize-1)] = i;
+		}
 	}
-	if (spec1) {
-		if (M_B(ucb) == 017)		// BIR3
-			M_B_W(ucb, IR & 15);
-		trr(ucb, aval);
-		return;
-	} else if (spec2) {
-		bval = breg(ucb, pil);	// set bit in bval
-	} else {
-		bval = breg(ucb, pil);
+	h = ghash(parent, addr, leaf);
+	for (; (i = g->hash[h & (g->hsize-1)]) >= 0; h++) {
+		n = &g->nodes[i];
+		if (n->g_parent == parent && n->g_addr == addr &&
+		    n->g_leaf == leaf)
+			return i;
+	}
+	if (g->nnodes == g->anodes) {
+		g->anodes *= 2;
+		if ((g->nodes = realloc(g->nodes,
+		    g->anodes * sizeof(struct gnode))) == NULL)
+			err(1, "realloc");
 	}
+	n = &g->nodes[i = g->nnodes++];
+	n->g_parent = parent;
+	n->g_addr = addr;
+	n->g_leaf = leaf;
+	n->g_n = 0;
+	g->hash[h & (g->hsize-1)] = i;
+	return i;
+}
 
-	true = 1;
-	if (M_B(ucb) != 012)
-		true = ckcond(ucb);
+static void
+gfetch(struct nd10 *c)
+{
+	struct gprofile *g = c->gprof;
+	int i, lvl = c->pil;
+
+	if (g->pend[lvl] == G_JPL) {
+		if (g->depth[lvl] < GDEPTH) {
+			g->stk[lvl][g->depth[lvl]].f_node = g->cur[lvl];
+			g->stk[lvl][g->depth[lvl]++].f_ret = g->ret[lvl];
+			g->cur[lvl] = gnode(g, g->cur[lvl], c->oldCP, 0);
+		}
+	} else if (g->pend[lvl] == G_EXIT) {
+		for (i = g->depth[lvl] - 1; i >= 0; i--)
+			if (g->stk[lvl][i].f_ret == c->oldCP)
+				break;
+		if (i >= 0) {
+			g->cur[lvl] = g->stk[lvl][i].f_node;
+			g->depth[lvl] = i;
+		}
+	}
+	g->pend[lvl] = 0;
+	g->nodes[gnode(g, g->cur[lvl], c->oldCP, 1)].g_n++;
+	g->ops[EPG(c->IR)]++;
+	if ((c->IR & 0174000) == 0134000) {
+		g->pend[lvl] = G_JPL;
+		g->ret[lvl] = (Reg)(c->oldCP + 1);
+	} else if (c->IR == 0146142)
+		g->pend[lvl] = G_EXIT;
+}
 
-	if (true)
-		dval = alu(ucb, aval, bval, M_ARSEL(ucb));
+#ifndef LIBND10
+static char *gprofname;
+static pid_t gprofpid;
 
-	if (true) {
-		AC[M_ARSEL(ucb)] = dval;
-		setdreg(ucb, dval, pil);
-	}
+static void
+gpath(struct nd10 *c, FILE *fp, struct gnode *nodes, int i)
+{
+	char sym[40];
 
-	if (M_CHLEV(ucb) && inton) {
-		// Change level.  Update pil/pvl.
-		pvl = pil;
-		pil = pk_calc();
+	if (nodes[i].g_parent < 0) {
+		fprintf(fp, "level%d", nodes[i].g_addr);
+		return;
 	}
+	gpath(c, fp, nodes, nodes[i].g_parent);
+	if (c->nsyms && symname(c, nodes[i].g_addr, sym, sizeof(sym)))
+		fprintf(fp, ";%s", sym);
+	else
+		fprintf(fp, ";%06o", nodes[i].g_addr);
+}
+
+static int
+gopcmp(const void *a, const void *b)
+{
+	unsigned long na = mainc->gprof->ops[*(const int *)a];
+	unsigned long nb = mainc->gprof->ops[*(const int *)b];
 
-	cycles(ucb, aval);
+	return na < nb ? 1 : na > nb ? -1 : *(const int *)a - *(const int *)b;
 }
 
+/* the stacks and the entry point counts, named from uc-opc if there */
+static void
+gprofreport(void)
+{
+	struct nd10 *c = mainc;
+	struct gprofile *g = c->gprof;
+	char buf[PATH_MAX], name[20], names[4096][40];
+	unsigned int op, ent;
+	int i, n, ord[4096];
+	FILE *fp;
 
-void
-iblock(union ucent *uc)
+	if (getpid() != gprofpid)
+		return;
+	if ((fp = fopen(gprofname, "w")) == NULL) {
+		warn("%s", gprofname);
+		return;
+	}
+	for (i = 0; i < g->nnodes; i++) {
+		if (g->nodes[i].g_n == 0)
+			continue;
+		gpath(c, fp, g->nodes, i);
+		fprintf(fp, " %lu\n", g->nodes[i].g_n);
+	}
+	fclose(fp);
+
+	memset(names, 0, sizeof(names));
+	if ((fp = fopen("uc-opc", "r")) != NULL) {
+		while (fgets(buf, sizeof(buf), fp) != NULL) {
+			if (sscanf(buf, "%19s %o %o", name, &op, &ent) != 3 ||
+			    ent >= 4096 || strlen(names[ent]) + strlen(name) >
+			    sizeof(names[0]) - 2)
+				continue;
+			if (names[ent][0])
+				strcat(names[ent], " ");
+			strcat(names[ent], name);
+		}
+		fclose(fp);
+	}
+	snprintf(buf, sizeof(buf), "%s.ops", gprofname);
+	if ((fp = fopen(buf, "w")) == NULL) {
+		warn("%s", buf);
+		return;
+	}
+	for (i = n = 0; i < 4096; i++)
+		if (g->ops[i])
+			ord[n++] = i;
+	qsort(ord, n, sizeof(int), gopcmp);
+	fprintf(fp, "%ld instructions\n", c->icount);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%12lu %6.2f  %04o %s\n", g->ops[ord[i]],
+		    100.0 * g->ops[ord[i]] / c->icount, ord[i], names[ord[i]]);
+	fclose(fp);
+}
+
+static void
+gprofinit(struct nd10 *c, char *name)
 {
-	int bval, dval;
-	union ucent ucs, *ucb = &ucs;
+	struct gprofile *g;
+	int i;
 
-	int arsel = M_ARSEL(uc);
-	int spec1 = M_DEST(uc) == 012;
-	int spec2 = M_B(uc) == 012;
-	int spec3 = M_A(uc) == 012;
+	if ((g = c->gprof = calloc(1, sizeof(struct gprofile))) == NULL)
+		err(1, "calloc");
+	g->anodes = g->hsize = 1024;
+	if ((g->nodes = malloc(g->anodes * sizeof(struct gnode))) == NULL ||
+	    (g->hash = malloc(g->hsize * sizeof(int))) == NULL)
+		err(1, "malloc");
+	memset(g->hash, -1, g->hsize * sizeof(int));
+	for (i = 0; i < 16; i++)
+		g->cur[i] = gnode(g, -1, i, 0);
+	gprofname = name;
+	gprofpid = getpid();
+	atexit(gprofreport);
+}
 
-	*ucb = *uc;
-	ormap(uc, ucb);
-	int slvl = M_DIRECT(uc) ? pil : M_LEVEL(ucb);
-	int dlvl = M_DIRECT(uc) ? M_LEVEL(ucb) : pil;
+/*
+ * Microcode profile (-p).  Counts per microcode address are kept while
+ * running and written at exit, hottest first, with each word shown as
+ * dismac disassembles it.  dismac is looked for next to the program
+ * and then in PATH; without it only the words are shown.
+ */
+static char *profname, *profprom, profdis[PATH_MAX] = "dismac";
+static pid_t profpid;
+
+/* s in single quotes for the shell, at most len bytes with the NUL */
+static char *
+shquote(char *buf, size_t len, const char *s)
+{
+	size_t n = 0;
+
+	buf[n++] = '\'';
+	for (; *s && n + 5 < len; s++) {
+		if (*s == '\'') {
+			memcpy(buf + n, "'\\''", 4);
+			n += 4;
+		} else
+			buf[n++] = *s;
+	}
+	buf[n++] = '\'';
+	buf[n] = 0;
+	return buf;
+}
 
+static int
+profcmp(const void *a, const void *b)
+{
+	unsigned long na = mainc->uprof[*(const int *)a].p_n;
+	unsigned long nb = mainc->uprof[*(const int *)b].p_n;
 
-	int aval = areg(ucb, M_A(ucb), slvl);
-	if (spec1 == 0) // special case 1
-		bval = breg(ucb, pil);
+	return na < nb ? 1 : na > nb ? -1 : *(const int *)a - *(const int *)b;
+}
 
-	dval = alu(ucb, aval, bval, M_ARSEL(ucb));
+static void
+profreport(void)
+{
+	struct nd10 *c = mainc;
+	static char *dis[4096];
+	char buf[200], cmd[8*PATH_MAX + 20], *e;
+	char q1[4*PATH_MAX], q2[4*PATH_MAX];
+	unsigned long tot = 0;
+	int i, n, ord[4096];
+	FILE *fp;
 
-	if (spec1) {
-		if (M_DEST(uc)) {
-			printf("\n");
-			errx(1, "iblock dest 0%o not implemented: %08X line %o", M_DEST(uc), uc->line, mpc);
+	if (getpid() != profpid)
+		return;
+	snprintf(cmd, sizeof(cmd), "%s %s 2>/dev/null",
+	    shquote(q1, sizeof(q1), profdis), shquote(q2, sizeof(q2), profprom));
+	if ((fp = popen(cmd, "r")) != NULL) {
+		while (fgets(buf, sizeof(buf), fp) != NULL) {
+			if ((e = strchr(buf, '\n')) != NULL)
+				*e = 0;
+			i = strtol(buf, NULL, 8);
+			if (i >= 0 && i < 4096 && dis[i] == NULL)
+				dis[i] = strdup(buf);
 		}
-	} else {
-		switch (M_ORSPECS(ucb)) {
-		case 1: // only read
-		case 0: setdreg(ucb, dval, dlvl); break; // no or
+		pclose(fp);
+	}
 
-		case 3: setdreg(ucb, dval, dlvl); break;
+	for (i = n = 0; i < 4096; i++) {
+		tot += c->uprof[i].p_n;
+		if (c->uprof[i].p_n)
+			ord[n++] = i;
+	}
+	qsort(ord, n, sizeof(int), profcmp);
+	if ((fp = fopen(profname, "w")) == NULL) {
+		warn("%s", profname);
+		return;
+	}
+	fprintf(fp, "%lu micro-steps, %ld instructions\n", tot, c->icount);
+	fprintf(fp, "%12s %6s %12s %8s  word\n", "count", "%", "jumps",
+	    "iter");
+	for (i = 0; i < n; i++) {
+		struct ucprof *p = &c->uprof[ord[i]];
+
+		fprintf(fp, "%12lu %6.2f %12lu ", p->p_n, 100.0 * p->p_n / tot,
+		    p->p_jmp);
+		if (p->p_iter)
+			fprintf(fp, "%8.1f  ", (double)p->p_iter / p->p_n);
+		else
+			fprintf(fp, "%8s  ", "");
+		if (dis[ord[i]])
+			fprintf(fp, "%s\n", dis[ord[i]]);
+		else
+			fprintf(fp, "%04o: %08X\n", ord[i],
+			    c->rom[ord[i]].line);
+	}
+	fclose(fp);
+}
 
-		default:
-		if (M_ORSPECS(ucb)) {
-			printf("\n");
-			errx(1, "iblock orspecs 0%o not implemented: %08X line %o", M_ORSPECS(ucb), uc->line, mpc);
-		}
-		}
+static void
+profinit(struct nd10 *c, char *name, char *prom, char *argv0)
+{
+	char *s;
+
+	if ((c->uprof = calloc(4096, sizeof(struct ucprof))) == NULL)
+		err(1, "calloc");
+	c->engine = E_SWITCH;
+	profname = name;
+	profprom = prom;
+	if ((s = strrchr(argv0, '/')) != NULL) {
+		snprintf(profdis, sizeof(profdis), "%.*s/dismac",
+		    (int)(s - argv0), argv0);
+		if (access(profdis, X_OK) < 0)
+			strcpy(profdis, "dismac");
 	}
+	profpid = getpid();
+	atexit(profreport);
+}
+#endif
+
+/*
+ * Execute nsteps microinstructions, or forever if nsteps is negative.
+ */
+static void
+run(struct nd10 *c, long nsteps)
+{
+	if (c->engine == E_THREAD && c->tflag == 0)
+		runthr(c, nsteps);
+	else if (c->engine == E_BLOCK && c->tflag == 0)
+		runblk(c, nsteps);
+	else
+		runsw(c, nsteps);
+}
+
+/*
+ * The switch engine.  If rawdec is set the fields of each word are
+ * taken from the raw word when executed, see udecuse(); only for -B.
+ */
+static void
+runsw(struct nd10 *c, long nsteps)
+{
+	struct ucdec *ud, uds;
+
+	while (nsteps-- != 0) {
+		c->frmpc[c->frun++ & (FRSTEPS-1)] = c->mpc;
+		if (c->uprof)
+			c->uprof[c->mpc].p_n++;
+		if (c->rawdec) {
+			udecuse(&uds, c->rom[c->mpc].line);
+			ud = &uds;
+		} else
+			ud = &c->utab[c->mpc];
+		if (c->tflag) {
+			memset(&trcur, 0, sizeof(trcur));
+			trcur.t_mpc = c->mpc;
+			trcur.t_line = ud->line;
+			trbusy = 1;
+		}
+		switch (ud->op) {
+		case 0:
+			arith(c, ud);
+			break;
+
+		case 1: // interblock
+			iblock(c, ud);
+			break;
+
+		case 2:
+			jump(c, ud);
+			if (c->tflag)
+				trend(c);
+			continue;
+
+		case 3: // LOOP
+			loop(c, ud);
+			break;
+		}
+		c->mpc++;
+		if (c->tflag)
+			trend(c);
+	}
+}
+
+#ifndef LIBND10
+/*
+ * Run the same number of micro-steps with each decoding method in a
+ * separate process, starting from the same state, and print the rates.
+ * With native instructions a micro-step may be a whole batch of macro
+ * instructions, so that run is instead made as long (in instructions)
+ * as the one before it and the instruction rate is the one to compare.
+ */
+static void
+bench(struct nd10 *c, long nsteps)
+{
+	static struct {
+		char *name;
+		int eng, raw, nat;
+	} bcf[] = {
+		{ "per-use decode", E_SWITCH, 1, 0 },
+		{ "switch", E_SWITCH, 0, 0 },
+		{ "threaded", E_THREAD, 0, 0 },
+		{ "block", E_BLOCK, 0, 0 },
+		{ "block+native", E_BLOCK, 0, 1 },
+	};
+	struct timespec t0, t1;
+	double s;
+	pid_t cpid;
+	long ipos = c->ifd ? ftell(c->ifd) : 0;
+	long ilast = 0, n;
+	int i, pfd[2];
+
+	for (i = 0; i < (int)(sizeof(bcf)/sizeof(bcf[0])); i++) {
+		fflush(NULL);
+		if (pipe(pfd) < 0)
+			err(1, "pipe");
+		if ((cpid = fork()) < 0)
+			err(1, "fork");
+		if (cpid == 0) {
+			coreprivate(c);
+			c->engine = bcf[i].eng;
+			c->rawdec = bcf[i].raw;
+			c->native = bcf[i].nat;
+			if (c->ifd)	// the offset is shared with the parent
+				fseek(c->ifd, ipos, SEEK_SET);
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			if (c->native && ilast)
+				for (n = 0; c->icount < ilast && n < nsteps;
+				    n += 1000)
+					run(c, 1000);
+			else
+				run(c, n = nsteps);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			s = (t1.tv_sec - t0.tv_sec) +
+			    (t1.tv_nsec - t0.tv_nsec) / 1e9;
+			fflush(NULL);
+			fprintf(stderr, "%-16s %ld steps in %.3fs: %.0f steps/s, "
+			    "%.0f insns/s\n", bcf[i].name, n, s, n / s,
+			    c->icount / s);
+			if (write(pfd[1], &c->icount, sizeof(c->icount)) !=
+			    sizeof(c->icount))
+				_exit(1);
+			_exit(0);
+		}
+		close(pfd[1]);
+		if (read(pfd[0], &ilast, sizeof(ilast)) != sizeof(ilast))
+			errx(1, "bench child failed");
+		close(pfd[0]);
+		waitpid(cpid, NULL, 0);
+	}
+}
+#endif
+
+/*
+ * The interrupt system.  pkl is the highest level both requested (pid)
+ * and enabled (pie); it is found again here after any of pid, pie, pil
+ * or inton change, which also sets irqpend if the level must change.
+ * The fetch only looks at irqpend.  Lines raised by nd10_irq(), maybe
+ * from another thread, set irqpend too and are added to pid here, as
+ * are the devlines of devices that still want service, so that a WAIT
+ * that gives up the level does not lose them.  New console input sets
+ * ttikick, to find out here if it wants level 12.
+ */
+static void
+intcalc(struct nd10 *c)
+{
+	atomic_store(&c->irqpend, 0);
+	if (atomic_exchange(&c->ttikick, 0))
+		ttiline(c);
+	c->pid |= atomic_exchange(&c->irqlines, 0) | c->devlines;
+	intlevel(c);
+}
+
+/* pkl from pid and pie as they are, without taking new lines */
+static void
+intlevel(struct nd10 *c)
+{
+	unsigned int d;
+
+	d = c->pid & c->pie & 0177777;
+	c->pkl = d ? 31 - __builtin_clz(d) : 0;
+	if (c->inton && c->pkl != c->pil)
+		atomic_store(&c->irqpend, 1);
+}
+
+/*
+ * A device no longer requests the level: a request of it that has not
+ * been taken goes, so that the level is not entered with no one there.
+ */
+static void
+intdrop(struct nd10 *c, int level)
+{
+	c->devlines &= ~(1 << level);
+	if (c->pil != level)
+		c->pid &= ~(1 << level);
+}
+
+/* Is a level change due?  Then the interrupt microcode is run next. */
+static int
+intchange(struct nd10 *c)
+{
+	intcalc(c);
+	return c->inton && c->pkl != c->pil;
+}
+
+/*
+ * Request an interrupt on an external line.  May be called from any
+ * thread, also while the machine runs; the level is taken at the next
+ * instruction fetch.
+ */
+void
+nd10_irq(struct nd10 *c, int level)
+{
+
+	if (level < 0 || level > 15)
+		return;
+	atomic_fetch_or(&c->irqlines, 1u << level);
+	atomic_store(&c->irqpend, 1);
+}
+
+#ifndef LIBND10
+/* New console input for c, from the console thread; see ttiline(). */
+static void
+ttiwake(struct nd10 *c)
+{
+
+	atomic_store(&c->ttikick, 1);
+	atomic_store(&c->irqpend, 1);
+}
+#endif
+
+
+/*
+ * Post an internal interrupt for the given source.
+ */
+void
+int14(struct nd10 *c, int intr)
+{
+	c->iid |= intr;	/* set detect flipflop */
+	for (c->iic = 0; (intr & 1) == 0; c->iic++, intr >>= 1)
+		;
+	if (c->iid & c->iie) /* if internal int enabled, post priority int */
+		c->pid |= (1 << 14);
+	intcalc(c);
+}
+
+
+static void
+dprint(struct nd10 *c)
+{
+	char sym[40];
+
+//	if (wrtout == 0)
+//		return;
+	fprintf(c->dfp, "%06o: IR=%06o STS=%06o D=%06o B=%06o "
+	    "L=%06o A=%06o T=%06o X=%06o",
+	    c->oldCP, c->IR, c->STS[c->pil] + (c->pil << 8) + (c->inton << 15),
+	    c->D[c->pil], c->B[c->pil], c->L[c->pil], c->A[c->pil],
+	    c->T[c->pil], c->X[c->pil]);
+	if (c->nsyms && symname(c, c->oldCP, sym, sizeof(sym)))
+		fprintf(c->dfp, " <%s>", sym);
+	fputc('\n', c->dfp);
+	fprintf(c->dfp, "N: %ld\n", rtcleft(c));
+	fflush(c->dfp);
+}
+
+
+void
+ormap(struct nd10 *c, struct ucdec *uc, struct ucdec *ucb)
+{
+	switch (uc->orspecs) {
+	case 0: return;
+	case 1: // ORBWO
+	case 3: // ORBW
+		D_LEVEL_W(ucb, (c->CAR >> 3) & 017);
+		if (uc->op == 1) { // interblock
+			if ((c->CAR & 7) == 2)
+				ucb->a = 016;
+			else if (c->CAR & 7)
+				ucb->a = c->CAR & 7;
+			else
+				ucb->a = 010;
+		} else { // arith
+			if (c->CAR & 7)
+				ucb->a = c->CAR & 7;
+			else
+				ucb->a = 010;
+		}
+		if (uc->orspecs == 3) {
+			ucb->dest = ucb->a;
+			if (uc->op == 1)
+				ucb->a = uc->a;
+		}
+		break;
+
+	case 04: // ORSKP ARM
+		if (uc->cond == 0) {
+			// set A and B
+			ucb->a = (c->IR >> 3) & 7;
+			ucb->b = (c->IR & 7) | (ucb->b & 8);
+		}
+		D_TC_W(ucb, (c->IR >> 8) & 7);
+		break;
+
+	case 05: // ORROP
+		ucb->a = (c->CAR >> 3) & 7;
+		ucb->dest = c->CAR & 7;
+		ucb->b = uc->b & 010;
+		if (BIT6(c->CAR) == 0)
+			ucb->b |= c->CAR & 7;
+		break;
+
+	case 06: // ORSW2
+		if (uc->cond == 0) {
+			ucb->a = (c->CAR >> 3) & 7;
+			ucb->b = (uc->b & 010) | (c->CAR & 7);
+		}
+		ucb->dest = c->CAR & 7;
+		break;
+
+	case 07: // ORSW3
+		ucb->a = (c->CAR >> 3) & 7;
+		ucb->b = (uc->b & 010) | (c->CAR & 7);
+		ucb->dest = ucb->a;
+		break;
+
+	default:
+		uerrx(c, "ormap 0%o not implemented: %08X line %o", uc->orspecs,
+		    uc->line, c->mpc);
+	}
+}
+
+#define AMISS(x) if (uc->x) \
+	uerrx(c, "arith " #x " 0%o not implemented: %08X line %o", uc->x, \
+	    uc->line, c->mpc)
+
+static int
+areg(struct nd10 *c, struct ucdec *uc, int regno, int lvl)
+{
+	int rv = 0;
+
+	switch (regno) {
+	case 000: rv = 0; break;
+	case 001: rv = c->D[lvl]; break;
+	case 002: rv = c->CP; break;
+	case 003: rv = c->B[lvl]; break;
+	case 004: rv = c->L[lvl]; break;
+	case 005: rv = c->A[lvl]; break;
+	case 006: rv = c->T[lvl]; break;
+	case 007: rv = c->X[lvl]; break;
+
+	case 010: rv = c->STS[lvl]; break;
+	case 011: rv = SEXT8(c->H); break;
+	case 012: rv = 0; break;	// unused
+	case 013: rv = c->H; break;
+	case 014: rv = c->S1[lvl]; break;
+	case 015: rv = c->R; break;
+	case 016: rv = c->SP[lvl]; break;	// SP
+	case 017: rv = c->S2[lvl]; break;	// Scratch II
+	}
+	if (c->tflag) {
+		trcur.t_flags |= TR_A;
+		trcur.t_areg = regno;
+		trcur.t_alvl = lvl;
+		trcur.t_aval = rv;
+	}
+
+	c->Alatch[uc->arsel] = rv;
+	return rv;
+}
+
+static int
+breg(struct nd10 *c, struct ucdec *uc, int lvl)
+{
+	int rv = 0;
+
+	switch (uc->b) {
+	case 000: rv = 0; break;
+	case 001: rv = c->D[lvl]; break;
+	case 002: rv = c->CP; break;		// Current P
+	case 003: rv = c->B[lvl]; break;
+	case 004: rv = c->L[lvl]; break;
+	case 005: rv = c->A[lvl]; break;
+	case 006: rv = c->T[lvl]; break;
+	case 007: rv = c->X[lvl]; break;
+
+	case 011: rv = c->SH[uc->arsel]; break;		// Shift reg
+	case 012:	// special case 2
+		rv = (1 << uc->level);
+		break;
+	case 013: rv = c->AC[uc->arsel]; break;			// AC
+	case 014:
+		rv = c->AC[uc->arsel] >> 1;
+		if (uc->arsel == 0 && (c->AC[1] & 1))
+			rv |= 0100000;	// ACs connected in HAC
+		else if (uc->arsel)
+			rv |= (c->bC << 15);
+		break;						// 1/2 AC
+	case 015:
+		rv = c->AC[uc->arsel] << 1;
+		if (uc->arsel)		// ACs connected in 2AC
+			rv |= (c->AC[0] >> 15);
+		break;						// 2*AC
+
+	default:
+		if (uc->b)
+			uerrx(c, "arith b 0%o not implemented: %08X line %o",
+			    uc->b, uc->line, c->mpc);
+	}
+	if (c->tflag) {
+		trcur.t_flags |= TR_B;
+		trcur.t_bval = rv;
+	}
+	return rv; // XXX
+}
+
+/* transfer to H reg, special 3 */
+static void
+tra(struct nd10 *c, struct ucdec *uc)
+{
+	switch (uc->b) {
+	case 001: c->H = c->STS[c->pil]; break;	// status reg
+	case 002: c->H = 0; break;		// OPR
+	case 003:			// pgs, unlocked by reading it
+		c->H = c->pgs;
+		c->pglock = 0;
+		break;
+	case 004: c->H = c->pvl; break;	// PVL
+	case 005:			// iic, clears it and the detect ffs
+		c->H = c->iic;
+		c->iic = c->iid = 0;
+		break;
+
+	case 006: intcalc(c); c->H = c->pid; break;	// pid
+	case 007: c->H = c->pie; break;	// pie
+	case 010: c->H = 0; break;		// cache status (0 == no cache)
+	case 011: c->H = (1 << c->pil); break;// dpil XXX
+	case 012: c->H = 0400; break;	// ALD
+	case 013: c->H = c->pes; break;	// pes
+	case 014: c->H = c->mpc+1; break;	// MPC to H
+	case 015: c->H = c->pea; break;	// pea
+
+	case 016: c->H = c->ioreg; break;	// IO to H
+
+	default:
+		if (uc->b)
+			uerrx(c, "arith b 0%o not implemented: %08X line %o",
+			    uc->b, uc->line, c->mpc);
+	}
+}
+
+static void
+trr(struct nd10 *c, struct ucdec *uc, int aval)
+{
+	switch (uc->b) {
+	case 000: /* printf(" PAC=%06o", aval); */ break;
+	case 001: c->STS[c->pil] = aval; break;
+	case 002: /* printf(" LMP=%06o", aval); */ break;
+	case 003:			// PCR of the level in bits 6-3
+		c->PCR = aval;
+		c->pcr[(aval >> 3) & 017] = aval & 03603;
+		break;
+	case 004:
+		// Setting of bit 0-3 flips paging/interrupt (RS latch)
+		if (aval & 04) c->pgon = 0;
+		else if (aval & 010) c->pgon = 1;
+		if (aval & 01) c->inton = 0;
+		else if (aval & 02) c->inton = 1;
+		intcalc(c);
+		if (aval & 020) {
+		// Setting bit 4 sets MCALL D-ff (1058 1D), which in turn sets 
+		//  interrupt request ff (1058 13D)
+		// Clearing bit 4 clears the MCALL ff, but the interrupt request remains.
+		// Slightly different logic ic used here
+			int14(c, IIE_MC);
+		}
+		break;
+
+	case 005: c->iie = aval; break;
+
+	case 006: c->pid = aval; intcalc(c); break;
+	case 007: c->pie = aval; intcalc(c); break;
+
+	case 013: c->CAR = aval; break;
+	case 014:
+		c->H = c->CAR = aval;
+		if (c->dfp)
+			dprint(c);
+		c->mpc = EPG(c->IR)-1; // writing to IR resets MPC
+		break;
+
+	case 015: break; // XXX unused???
+
+	case 016:
+		c->ioreg = aval;
+		if ((c->CAR & 0174000) == 0164000)
+			ioexec(c, uc);
+		else if ((c->CAR & 0177700) == 0143600)
+			ident(c, uc);
+		else
+			fprintf(stderr, "ioreg! IR %06o\r\n", c->IR);
+		break;
+
+	default:
+		uerrx(c, "trr 0%o not implemented: %08X line %o", uc->b,
+		    uc->line, c->mpc);
+	}
+}
+
+static void
+setdreg(struct nd10 *c, struct ucdec *uc, int dval, int lvl)
+{
+	if (c->tflag) {
+		trcur.t_flags |= TR_D;
+		trcur.t_dreg = uc->dest;
+		trcur.t_dlvl = lvl;
+		trcur.t_dval = dval;
+	}
+	switch (uc->dest) {
+	case 001: c->D[lvl] = dval; break;		// D
+	case 002: c->CP = dval; break;		// Current P
+	case 003: c->B[lvl] = dval; break;		// B
+	case 004: c->L[lvl] = dval; break;		// L
+	case 005: c->A[lvl] = dval; break;		// A
+	case 006: c->T[lvl] = dval; break;		// T
+	case 007: c->X[lvl] = dval; break;		// X
+	case 010: c->STS[lvl] = dval; break;	// Status
+	case 011: c->SH[uc->arsel] = dval; break;		// Shift reg
+	case 013:				// Shift counter
+		c->SC = dval & 077;
+		if (c->SC > 037) c->SC |= (0xffffffff << 6);
+		break;
+	case 014: c->S1[lvl] = dval; break;	// Scratch I
+	case 016: c->SP[lvl] = dval; break;	// Saved P
+	case 017: c->S2[lvl] = dval; break;	// Scratch II
+
+	default:
+		if (uc->dest)
+			uerrx(c, "arith dest 0%o not implemented: %08X line %o",
+			    uc->dest, uc->line, c->mpc);
+	}
+}
+
+int
+ckcond(struct nd10 *c, struct ucdec *uc)
+{
+	int n;
+
+	if (uc->cond == 0)
+		return 1; // no test condition
+	switch (uc->tc & 03) {
+	case 0: /* eql */ n = c->bZ; break;
+	case 1: /* geq */ n = c->bS == 0; break;
+	case 2: /* gre */ n = (c->bS ^ c->bO) == 0; break;
+	case 3: /* mgre */ n = c->bC; break;
+	}
+	if (uc->tc & 04)
+		n = !n;
+	return n;
+}
+
+/*
+ * The 74181 function and the flags it sets, cin is carry in.
+ * Returns the unmasked result.
+ */
+static inline int
+alu181(struct nd10 *c, struct ucdec *uc, Reg aval, Reg bval, int cin, int most)
+{
+	int dval = 0;
+	Reg negA = ~aval;
+
+	switch (uc->alu) {
+	case 000: dval = bval - 1; break;		// BM1
+	case 001: dval = aval + bval; break;		// PLUS XXX
+	case 002: dval = bval + negA; break;		// BMAM1 (B-A-1)
+	case 003: dval = bval; break;			// BDI
+
+	case 005: dval = bval + aval + cin; break;	// PLUS ADDC
+	case 006: dval = bval + negA + cin; break;	// BMAM1 ADDC (B-A-1)+C
+
+	case 011: dval = aval + bval; break;		// PLUS
+
+	case 015: dval = aval + bval + 1; break;	// PLUS + 1
+	case 016: dval = bval + negA + 1; break;	// BMINA (B-A)
+	case 017: dval = bval + 1; break;		// BDI ADD1
+	case 020: dval = ~bval; break;			// BDIRC
+
+	case 022: dval = aval | ~bval; break;		// ORCB
+
+	case 024: dval = ~(aval|bval); break;		// ORC
+	case 025: dval = ~aval; break;			// ADIRC
+
+	case 030: dval = aval & ~bval; break;		// ANCB
+	case 031: dval = aval ^ bval; break;		// EXOR
+	case 032: dval = aval; break;			// ADIR
+	case 033: dval = aval | bval; break;		// AND
+
+	case 035: dval = ~aval & bval; break;		// ANDCA
+	case 036: dval = aval & bval; break;		// AND
+	case 037: dval = bval; break;			// BDIR
+
+	default:
+		uerrx(c, "alu 0%o not implemented: %08X line %o", uc->alu,
+		    uc->line, c->mpc);
+	}
+
+	if (most) {
+		if (uc->alu == 016 || uc->alu == 002 || uc->alu == 006)
+			aval = negA;
+		c->bZ = ((dval & 0177777) == 0);
+		c->bO = (!BIT15(bval ^ aval) && BIT15(bval ^ dval));
+		c->bS = BIT15(dval);
+		c->bC = dval > 0177777;
+	} else
+		c->bCl = dval > 0177777;
+
+	return dval;
+}
+
+int
+alu(struct nd10 *c, struct ucdec *uc, Reg aval, Reg bval, int most)
+{
+	int dval;
+	int cin = (c->STS[c->pil] & STS_C) != 0;
+
+	if (most && uc->op == 3)
+		cin = c->bCl; // combined
+
+	dval = alu181(c, uc, aval, bval, cin, most);
+
+	if (uc->ssave) {
+		c->STS[c->pil] &= ~(STS_C|STS_Q);
+		if (c->bC) c->STS[c->pil] |= STS_C;
+		if (c->bO) c->STS[c->pil] |= (STS_O|STS_Q);
+	}
+
+	return dval & 0177777;
+}
+
+
+/*
+ * Paging.  With paging on each access is translated through a page
+ * table chosen by the PCR of the current level, which names a normal
+ * table (PT), an alternative one (APT) and the ring the level runs in.
+ * Fetches and P-relative operands go through the PT, B-relative and
+ * indirect operands through the APT.  An entry gives the physical page,
+ * what may be done to it and from which ring up, and records that the
+ * page was used and written.  A page with no permits is not there (page
+ * fault); any other access that is not allowed is a protect violation.
+ *
+ * The tables are reached as shadow memory at 177400-177777, one table
+ * after the other: from ring 3 with paging on instead of memory, and
+ * with paging off a write goes both to them and to memory.
+ *
+ * Translations are kept in a small direct-mapped TLB tagged with the
+ * table, ring and page, so the tables are only looked at on a miss.
+ * An entry only allows a write once the page is marked written.  Any
+ * write to a table flushes it, as do changes of memory.
+ */
+#define	PT_WPM		0100000	/* write permitted */
+#define	PT_RPM		0040000	/* read permitted */
+#define	PT_FPM		0020000	/* fetch permitted */
+#define	PT_WIP		0010000	/* written in page */
+#define	PT_PGU		0004000	/* page used */
+#define	PT_RING		0003000	/* lowest ring allowed */
+#define	PT_PPN		0000777	/* physical page */
+#define	PG_ALT		1	/* with PT_*PM, through the APT */
+
+#define	PGS_FF		0100000	/* the fault was at a fetch */
+#define	PGS_PM		0040000	/* not a missing page */
+
+#define	SHADOW		0177400
+
+#define	VREAD(a, k)	(c->pgon ? vread(c, a, k) : c->mem[a])
+#define	VWRITE(a, v, k)	((c->pgon || (a) >= SHADOW) ? vwrite(c, a, v, k) : \
+	(void)(c->mem[a] = (v)))
+
+static void
+tlbflush(struct nd10 *c)
+{
+	memset(c->tlb, 0, sizeof(c->tlb));
+}
+
+/*
+ * Post an internal interrupt for an access or instruction that is not
+ * allowed and abort the instruction, so that it starts again on return
+ * (not yet fetched if fetch is set).  If the interrupt is not taken
+ * (interrupts off, or the source not enabled in IIE) the CPU stops to
+ * the console at the instruction, as for an illegal one; it must not
+ * go on with a word it could not read.  The rest of the cycle then
+ * does nothing.
+ */
+static void
+pgabort(struct nd10 *c, int intr, int fetch)
+{
+	int14(c, intr);
+	if (!fetch)
+		c->CP = c->oldCP;
+	if (intchange(c))
+		c->mpc = 0400 - 1;
+	else {
+		c->mpc = -1; // stop
+		if (c->frfp)
+			frdump(c, "fault");
+	}
+	c->pgtrap = 1;
+}
+
+static void
+pgfault(struct nd10 *c, int intr, int page, int kind)
+{
+	if (!c->pglock) {
+		c->pgs = page | (kind & PT_FPM ? PGS_FF : 0) |
+		    (intr == IIE_PV ? PGS_PM : 0);
+		c->pglock = 1;
+	}
+	pgabort(c, intr, kind & PT_FPM);
+}
+
+/* the word at virtual addr, NULL if the access traps */
+static unsigned short *
+pgmap(struct nd10 *c, int addr, int kind)
+{
+	int p = c->pcr[c->pil], page = addr >> 10, tab, tag;
+	struct tlbent *t;
+	long phys;
+	Reg e;
+
+	tab = kind & PG_ALT ? (p >> 7) & 3 : (p >> 9) & 3;
+	tag = (tab << 8 | (p & 3) << 6 | page) + 1;
+	t = &c->tlb[(page ^ tab << 4) & (NTLB-1)];
+	if (t->t_tag == tag && (t->t_perm & kind))
+		return &t->t_page[addr & 01777];
+
+	e = c->ptab[tab][page];
+	if ((e & (PT_WPM|PT_RPM|PT_FPM)) == 0) {
+		pgfault(c, IIE_PF, page, kind);
+		return NULL;
+	}
+	if ((e & kind & (PT_WPM|PT_RPM|PT_FPM)) == 0 ||
+	    (p & 3) < (e & PT_RING) >> 9) {
+		pgfault(c, IIE_PV, page, kind);
+		return NULL;
+	}
+	phys = (long)(e & PT_PPN) << 10;
+	if (phys >= c->memsize) {
+		c->pea = phys | (addr & 01777);
+		c->pes = phys >> 16;
+		pgabort(c, IIE_MOR, kind & PT_FPM);
+		return NULL;
+	}
+	e |= PT_PGU | (kind & PT_WPM ? PT_WIP : 0);
+	c->ptab[tab][page] = e;
+	t->t_tag = tag;
+	t->t_page = &c->mem[phys];
+	t->t_perm = e & (PT_RPM|PT_FPM);
+	if (e & PT_WIP)
+		t->t_perm |= e & PT_WPM;
+	return &t->t_page[addr & 01777];
+}
+
+/* read for an access of kind, 0 if it traps; see VREAD */
+static int
+vread(struct nd10 *c, int addr, int kind)
+{
+	unsigned short *w;
+
+	if (c->pgtrap)
+		return 0;
+	if (!c->pgon)
+		return c->mem[addr];
+	if (addr >= SHADOW && (c->pcr[c->pil] & 3) == 3)
+		return c->ptab[(addr >> 6) & 3][addr & 077];
+	return (w = pgmap(c, addr, kind)) ? *w : 0;
+}
+
+static void
+vwrite(struct nd10 *c, int addr, int v, int kind)
+{
+	unsigned short *w;
+
+	if (c->pgtrap)
+		return;
+	if (addr >= SHADOW && (!c->pgon || (c->pcr[c->pil] & 3) == 3)) {
+		c->ptab[(addr >> 6) & 3][addr & 077] = v;
+		tlbflush(c);
+		if (c->pgon)
+			return;
+	}
+	if (!c->pgon)
+		c->mem[addr] = v;
+	else if ((w = pgmap(c, addr, kind | PT_WPM)) != NULL)
+		*w = v;
+}
+
+/* also notes in ralt which page table the operand is in */
+int
+calcea(struct nd10 *c)
+{
+	int ea;
+
+	if ((c->IR & 0174000) == 0130000) {
+		ea = SEXT8(c->IR) + c->oldCP;
+		c->ralt = 0;
+	} else {
+		ea = BIT8(c->IR) ? c->B[c->pil] : c->oldCP;
+		if (BIT10(c->IR) & !BIT9(c->IR) & !BIT8(c->IR))
+			ea = 0;
+		ea += SEXT8(c->IR);
+		if (BIT9(c->IR))
+			ea = VREAD(ea & 0177777, PT_RPM | BIT8(c->IR));
+		if (BIT10(c->IR))
+			ea += c->X[c->pil];
+		c->ralt = BIT8(c->IR) | BIT9(c->IR);
+	}
+	return ea & 0177777;
+}
+
+/*
+ * Events.  A device that needs something done later (a tick, a
+ * transfer done, an interrupt) schedules a function for the fetch at
+ * which it should run.  The events are kept in a heap on that fetch
+ * count, so the fetch only has to compare icount with evnext, the
+ * first of them.  A function has at most one event pending.
+ */
+static void
+evdown(struct nd10 *c, int i)
+{
+	struct event e = c->evq[i];
+	int j;
+
+	for (; (j = 2*i + 1) < c->nev; i = j) {
+		if (j + 1 < c->nev && c->evq[j+1].e_at < c->evq[j].e_at)
+			j++;
+		if (e.e_at <= c->evq[j].e_at)
+			break;
+		c->evq[i] = c->evq[j];
+	}
+	c->evq[i] = e;
+}
+
+static void
+evup(struct nd10 *c, int i)
+{
+	struct event e = c->evq[i];
+
+	for (; i > 0 && e.e_at < c->evq[(i-1)/2].e_at; i = (i-1)/2)
+		c->evq[i] = c->evq[(i-1)/2];
+	c->evq[i] = e;
+}
+
+static void
+evcancel(struct nd10 *c, void (*fn)(struct nd10 *))
+{
+	int i;
+
+	for (i = 0; i < c->nev; i++)
+		if (c->evq[i].e_fn == fn)
+			break;
+	if (i == c->nev)
+		return;
+	c->evq[i] = c->evq[--c->nev];
+	if (i < c->nev) {
+		evup(c, i);
+		evdown(c, i);
+	}
+	c->evnext = c->nev ? c->evq[0].e_at : LONG_MAX;
+}
+
+/* when fn is scheduled, LONG_MAX if not */
+static long
+evwhen(struct nd10 *c, void (*fn)(struct nd10 *))
+{
+	int i;
+
+	for (i = 0; i < c->nev; i++)
+		if (c->evq[i].e_fn == fn)
+			return c->evq[i].e_at;
+	return LONG_MAX;
+}
+
+/* nothing can happen before the next event, so let it happen now */
+static void
+evskip(struct nd10 *c)
+{
+	long d = c->evnext - c->icount;
+	int i;
+
+	if (c->nev == 0 || d <= 0)
+		return;
+	for (i = 0; i < c->nev; i++)
+		c->evq[i].e_at -= d;
+	c->evnext -= d;
+}
+
+static void
+evsched(struct nd10 *c, void (*fn)(struct nd10 *), long at)
+{
+	evcancel(c, fn);
+	if (c->nev == NEVENTS) {
+		uerrx(c, "too many events");
+		return;
+	}
+	c->evq[c->nev].e_at = at;
+	c->evq[c->nev].e_fn = fn;
+	evup(c, c->nev++);
+	c->evnext = c->evq[0].e_at;
+}
+
+/* run the events due */
+static void
+evrun(struct nd10 *c)
+{
+	void (*fn)(struct nd10 *);
+
+	while (c->nev && c->evq[0].e_at <= c->icount) {
+		fn = c->evq[0].e_fn;
+		c->evq[0] = c->evq[--c->nev];
+		evdown(c, 0);
+		c->evnext = c->nev ? c->evq[0].e_at : LONG_MAX;
+		(*fn)(c);
+	}
+}
+
+/*
+ * Fetch cycle.
+ * 1) check if pending interrupts.
+ * 2) Fetch instrction
+ * 3) Ensure mpc is within memory space
+ * With -n, instructions that have a native handler are executed here
+ * directly and the next one fetched, until one that needs microcode.
+ */
+static void
+cfc(struct nd10 *c)
+{
+	int n, ls;
+	nfn_t fn;
+
+	for (n = 0; ; n++) {
+		if (c->lsarm)
+			lscheck(c);
+		if (atomic_load_explicit(&c->irqpend, memory_order_relaxed) &&
+		    intchange(c)) {
+			c->mpc = 0400 - 1;
+			return;
+		}
+		c->pgtrap = 0;
+		c->H = c->CAR = VREAD(c->CP, PT_FPM);
+		if (c->pgtrap)
+			return;		// fault, to its interrupt
+		c->oldCP = c->CP++;
+		c->icount++;
+		frinsn(c);
+		if (c->gprof)
+			gfetch(c);
+		if (c->ckarm)
+			checkpoint(c);
+		if (c->dfp)
+			dprint(c);
+		if (c->kmode != K_FETCH && c->inton &&
+		    (c->IR & 0177400) == 0151000)
+			idle(c);		// WAIT for an interrupt
+		if (c->icount >= c->evnext)
+			evrun(c);
+		ls = c->lockstep && !c->pgon && (c->lockstep == 2 ||
+		    (c->icount & (LSPERIOD-1)) < LSWINDOW);
+		if (ls)		// after the events, seen by both runs
+			lsstart(c, ntab[c->IR >> EPGSHIFT]);
+		if (c->native && !ls && !c->pgon && n < NBATCH &&
+		    c->icount <= c->ilimit &&
+		    (fn = ntab[c->IR >> EPGSHIFT]) && (*fn)(c))
+			continue;
+		if (c->inton == 0 && (c->IR & 0177400) == 0151000) {
+			c->mpc = -1; // stop
+			if (c->frfp)
+				frdump(c, "halt");
+		} else
+			c->mpc = EPG(c->IR)-1;		
+		// mpc will be incremented before next micro insn
+		if (c->mpc > c->promsz-1) { // Illegal instruction
+			int14(c, IIE_II);
+			if (intchange(c))
+				c->mpc = 0400 - 1;
+			else {
+				c->mpc = -1; // stop
+				if (c->frfp)
+					frdump(c, "illegal");
+			}
+		}
+		return;
+	}
+}
+
+void
+cycles(struct nd10 *c, struct ucdec *uc, int aval)
+{
+	if (uc->cycle == 0)
+		return;
+	if (c->tflag) {
+		trcur.t_flags |= TR_CYC;
+		trcur.t_cycle = uc->cycle;
+		trcur.t_cadr = c->mem[052744];
+	}
+
+	c->pgtrap = 0;
+	switch (uc->cycle) {
+	case 01:				// CEATR
+		c->R = calcea(c);
+		break;
+
+	case 02:				// CPTR
+		c->R = c->CP;
+		c->ralt = 0;
+		break;
+
+	case 03:				// CFC
+		cfc(c);
+		if (snapreq)
+			snapshot(c);
+		if (frreq)
+			frsig(c);
+		break;
+
+	// Write cycle: A goes to IB which is written to memory.
+	case 04:
+		if (c->lsarm)
+			lslog(c, (Reg)(c->R + 1));
+		c->R++;
+		VWRITE(c->R, aval, c->ralt);
+		break;				// CWR1
+	case 05:				// CW
+		c->R = calcea(c);
+		if (c->lsarm)
+			lslog(c, c->R);
+		VWRITE(c->R, aval, c->ralt);
+		break;
+
+	case 06:				// CRR1
+		c->R++;
+		c->H = VREAD(c->R, PT_RPM | c->ralt);
+		break;
+	case 07:
+		c->R = calcea(c);
+		c->H = VREAD(c->R, PT_RPM | c->ralt);
+		break;				// CR
+
+	default: ;
+	}
+	if (c->tflag)
+		trcur.t_cadr2 = c->mem[052744];
+}
+
+void
+arith(struct nd10 *c, struct ucdec *uc)
+{
+	int aval, bval;
+	int dval;
+	int true;
+	struct ucdec ucs, *ucb = uc;
+
+	int spec1 = uc->dest == 012;
+	int spec2 = uc->b == 012;
+	int spec3 = uc->a == 012;
+
+	if (uc->orspecs || uc->b == 017) {	// only copy if modified
+		ucs = *uc;
+		ucb = &ucs;
+		ormap(c, uc, ucb);
+	}
+	aval = areg(c, ucb, ucb->a, c->pil);
+
+	if (spec3) {
+		if (ucb->b == 017)
+			ucb->b = c->IR & 15;
+		tra(c, ucb);
+		return;
+	}
+	if (spec1) {
+		if (ucb->b == 017)		// BIR3
+			ucb->b = c->IR & 15;
+		trr(c, ucb, aval);
+		return;
+	} else if (spec2) {
+		bval = breg(c, ucb, c->pil);	// set bit in bval
+	} else {
+		bval = breg(c, ucb, c->pil);
+	}
+
+	true = 1;
+	if (ucb->b != 012)
+		true = ckcond(c, ucb);
+
+	if (true)
+		dval = alu(c, ucb, aval, bval, ucb->arsel);
+
+	if (true) {
+		c->AC[ucb->arsel] = dval;
+		setdreg(c, ucb, dval, c->pil);
+	}
+
+	if (ucb->chlev && c->inton) {
+		// Change level.  Update pil/pvl.
+		intcalc(c);
+		c->pvl = c->pil;
+		c->pil = c->pkl;
+		intcalc(c);
+	}
+
+	cycles(c, ucb, aval);
+}
+
+
+void
+iblock(struct nd10 *c, struct ucdec *uc)
+{
+	int bval = 0, dval;
+	struct ucdec ucs, *ucb = &ucs;
+
+	int spec1 = uc->dest == 012;
+
+	*ucb = *uc;
+	ormap(c, uc, ucb);
+	int slvl = uc->chlev ? c->pil : ucb->level;
+	int dlvl = uc->chlev ? ucb->level : c->pil;
+
+
+	int aval = areg(c, ucb, ucb->a, slvl);
+	if (spec1 == 0) // special case 1
+		bval = breg(c, ucb, c->pil);
+
+	dval = alu(c, ucb, aval, bval, ucb->arsel);
+
+	if (spec1) {
+		if (uc->dest) {
+			uerrx(c,
+			    "iblock dest 0%o not implemented: %08X line %o",
+			    uc->dest, uc->line, c->mpc);
+		}
+	} else {
+		switch (ucb->orspecs) {
+		case 1: // only read
+		case 0: setdreg(c, ucb, dval, dlvl); break; // no or
+
+		case 3: setdreg(c, ucb, dval, dlvl); break;
+
+		default:
+		if (ucb->orspecs) {
+			uerrx(c,
+			    "iblock orspecs 0%o not implemented: %08X line %o",
+			    ucb->orspecs, uc->line, c->mpc);
+		}
+		}
+	}
+
+	cycles(c, ucb, aval);
+
+	if (ucb->ssave) {
+		uerrx(c, "iblock ssave 0%o not implemented: %08X line %o",
+		    ucb->ssave, uc->line, c->mpc);
+	}
+}
+
+#define EJUMP(x) if (uc->x) \
+	uerrx(c, "jump " #x " 0%o not implemented: %08X line %o", uc->x, \
+	    uc->line, c->mpc)
+
+void
+jump(struct nd10 *c, struct ucdec *uc)
+{
+	int true;
+
+	if (uc->priv && c->pgon && (c->pcr[c->pil] & 3) < 2) {
+		pgabort(c, IIE_PI, 0);	// only rings 2 and 3 may
+		c->mpc++;
+		return;
+	}
+	true = ckcond(c, uc);
+	if (c->uprof && true)
+		c->uprof[c->mpc].p_jmp++;
+	if (true)
+		c->mpc = uc->car ? c->CAR : uc->addr;
+	else
+		c->mpc++;
+	if (c->tflag) {
+		trcur.t_flags |= TR_JMP | (uc->cond ? TR_CJMP : 0);
+		trcur.t_jmp = c->mpc;
+	}
+}
+
+/*
+ * Loop instruction ALU ops reads from B, does something and saves in AC.
+ */
+void	
+loop(struct nd10 *c, struct ucdec *uc)
+{
+	int m, xbit = 0, shright;
+	int aclbit = 0;
+	unsigned long n = 0;
+
+	shright = uc->lorsht ? (c->IR & 040) : uc->lshr;
+
+	// 1 == rotational, 2 == zero input
+	int shtyp = uc->lorsht ? (c->IR >> 9) & 3 : uc->lsht;
+
+	for (;;) {
+		if (uc->term == 0 && c->SC == 0)
+			break;
+		if (uc->term == 2 && (c->SC == 0 || (c->SH[1] & 0100000)))
+			break;
+		if (uc->term == 3 && (c->SC == 0 || (c->SH[1] & 0000100)))
+			break;
+
+		unsigned int ACL, ALL;
+
+		ALL = (c->Alatch[1] << 16) | c->Alatch[0];
+		ACL = (c->AC[1] << 16) | c->AC[0];
+
+		switch (uc->lb) {
+		case 0: ACL = 0; break;
+		case 013: break;
+		case 014: 
+			ACL >>= 1;
+			ACL |= (aclbit << 31);
+			// XXX input fr}n ALU???
+			break;
+
+		case 015:
+			ACL <<= 1;
+			// XXX
+			break;
+
+		default: 
+			uerrx(c, "unspec B reg %02o", uc->lb);
+		}
+
+		int alucmd = uc->alu;
+		if ((uc->lalt && BIT0(c->SH[0])) ||
+		    ((uc->lalt == 0) && BIT15(c->SH[1])))
+			alucmd = uc->lalul;
+
+		int acsign = BIT15(c->AC[1]); // before calculations
+		ull ACLlong = 0;
+		unsigned int acinv = ~ALL;
+		Reg ACold = ACL;	// the B input, tested at bit 15 as the rest
+		switch (alucmd) {
+		case 00: ACLlong = ACL-1; break;	// BM1
+		case 01: ACLlong = (ull)ACL + (ull)ALL; break;// PLUS
+		case 03: ACLlong = ACL;	break;			// BD1
+		case 016:
+			ACLlong = (ull)ACL + (ull)acinv + 1;
+			break;
+		default:
+			uerrx(c, "bad cmd %02o", alucmd);
+		}
+
+		c->AC[1] = ACLlong >> 16;
+		c->AC[0] = ACLlong;
+		aclbit = ACLlong > 0xffffffffULL;
+		c->bZ = c->AC[1] == 0;
+		c->bC = aclbit;
+		c->bS = BIT15(c->AC[1]);
+		c->bO = BIT15(alucmd == 016 ? acinv : ALL) ^ BIT15(ACold);
+		c->bO = ((c->bO == 0) && BIT15(ACold ^ ACLlong));
+		if (uc->ssave) {
+			c->STS[c->pil] &= ~(STS_C|STS_Q);
+			if (c->bC) c->STS[c->pil] |= STS_C;
+			if (c->bO) c->STS[c->pil] |= (STS_O|STS_Q);
+		}
+
+		switch (uc->tg) {
+		case 0: break;
+		case 1: if (c->SH[0] & 1) c->STS[c->pil] |= STS_TG; break;
+		case 2: if (c->AC[0] & 1) c->STS[c->pil] |= STS_TG; break;
+		case 3: if ((c->AC[0] | c->AC[1]) == 0) c->STS[c->pil] |= STS_TG; break;
+		}
+
+
+		if (shright == 0) { // shift left
+			m = (c->SH[1] & 0100000) != 0;
+			/* defined at 1062 lower left */
+			if (uc->endid) {	// shift left input
+				if (acsign) {
+					xbit = c->bC ? 1 : BIT0(c->SH[0]);
+				} else
+					xbit = c->bC ? BIT0(c->SH[0]) : 0;
+			} else {
+				switch (shtyp) {
+				case 2: case 0: xbit = 0; break;
+				case 1: xbit = m; break;
+				case 3: xbit = ((c->STS[c->pil] & STS_M) != 0); break;
+				}
+			}
+			if (uc->lsh32) { // Combined shift
+				c->SH[1] = (c->SH[1] << 1) | BIT15(c->SH[0]);
+				c->SH[0] = (c->SH[0] << 1) | xbit;
+			} else
+				c->SH[1] = (c->SH[1] << 1) | xbit;
+		} else {
+			m = uc->lsh32 ? c->SH[0] & 1 : c->SH[1] & 1;
+			switch (shtyp) {
+			case 0: xbit = (c->SH[1] & 0100000) != 0; break;
+			case 1: xbit = m; break;
+			case 2: xbit = 0; break;
+			case 3: xbit = ((c->STS[c->pil] & STS_M) != 0); break;
+			}
+			if (uc->lsh32) {
+				c->SH[0] = (c->SH[0] >> 1) | (c->SH[1] << 15);
+				c->SH[1] = (c->SH[1] >> 1) | (xbit << 15);
+			} else
+				c->SH[1] = (c->SH[1] >> 1) | (xbit << 15);
+		}
+		if (uc->lm) {
+			c->STS[c->pil] &= ~STS_M;
+			if (m) c->STS[c->pil] |= STS_M;
+		}
+
+		if (c->SC < 0)
+			c->SC++;
+		else
+			c->SC--;
+		n++;
+	}
+	if (c->uprof)
+		c->uprof[c->mpc].p_iter += n;
+}
+
+/*
+ * Threaded code engine.  Each decoded word gets a handler when the PROM
+ * is loaded; the common word types have handlers that skip the tests
+ * arith() and jump() must do at run time.  Handlers update mpc.
+ * No tracing here, -t forces the switch engine.
+ */
+
+/* arith without ORSPECS, specials, level change or memory cycle */
+static void
+th_alu(struct nd10 *c, struct ucdec *uc)
+{
+	int aval, dval;
+
+	aval = areg(c, uc, uc->a, c->pil);
+	dval = breg(c, uc, c->pil);
+	if (ckcond(c, uc)) {
+		dval = alu(c, uc, aval, dval, uc->arsel);
+		c->AC[uc->arsel] = dval;
+		setdreg(c, uc, dval, c->pil);
+	}
+	c->mpc++;
+}
+
+/* as above, but with a memory cycle */
+static void
+th_alucyc(struct nd10 *c, struct ucdec *uc)
+{
+	int aval, dval;
+
+	aval = areg(c, uc, uc->a, c->pil);
+	dval = breg(c, uc, c->pil);
+	if (ckcond(c, uc)) {
+		dval = alu(c, uc, aval, dval, uc->arsel);
+		c->AC[uc->arsel] = dval;
+		setdreg(c, uc, dval, c->pil);
+	}
+	cycles(c, uc, aval);
+	c->mpc++;
+}
+
+static void
+th_arith(struct nd10 *c, struct ucdec *uc)
+{
+	arith(c, uc);
+	c->mpc++;
+}
+
+static void
+th_iblock(struct nd10 *c, struct ucdec *uc)
+{
+	iblock(c, uc);
+	c->mpc++;
+}
+
+static void
+th_loop(struct nd10 *c, struct ucdec *uc)
+{
+	loop(c, uc);
+	c->mpc++;
+}
+
+/* unconditional jump to address */
+static void
+th_jmp(struct nd10 *c, struct ucdec *uc)
+{
+	c->mpc = uc->addr;
+}
+
+/* conditional jump to address */
+static void
+th_cjmp(struct nd10 *c, struct ucdec *uc)
+{
+	if (ckcond(c, uc))
+		c->mpc = uc->addr;
+	else
+		c->mpc++;
+}
+
+static void
+th_jump(struct nd10 *c, struct ucdec *uc)
+{
+	jump(c, uc);
+}
+
+/*
+ * Select the handler for a decoded word.
+ */
+static void
+uclassify(struct ucdec *uc)
+{
+	switch (uc->op) {
+	case 0:
+		uc->fn = th_arith;
+		if (uc->orspecs || uc->chlev || uc->a == 012 ||
+		    uc->b == 012 || uc->dest == 012)
+			break;
+		uc->fn = uc->cycle ? th_alucyc : th_alu;
+		break;
+
+	case 1: uc->fn = th_iblock; break;
+
+	case 2:
+		uc->fn = th_jump;
+		if (uc->priv || uc->car)
+			break;
+		uc->fn = uc->cond ? th_cjmp : th_jmp;
+		break;
+
+	case 3: uc->fn = th_loop; break;
+	}
+}
+
+static void
+runthr(struct nd10 *c, long nsteps)
+{
+	struct ucdec *ud;
+
+	while (nsteps-- != 0) {
+		c->frmpc[c->frun++ & (FRSTEPS-1)] = c->mpc;
+		ud = &c->utab[c->mpc];
+		(*ud->fn)(c, ud);
+	}
+}
+
+/*
+ * Superblocks.  Most microcode is straight runs of ALU words (those
+ * handled by th_alu) ending in a jump, a memory cycle or a word that
+ * is patched from IR/CAR by ORSPECS.  Such a run is executed in one
+ * go with the registers of the current level held in a local array
+ * indexed by A register number, and written back when the run ends.
+ * The word that ends the run is executed by its threaded handler.
+ * blen in each word is the length of the run starting there, so that
+ * jumps into the middle of a run also get a block.
+ */
+
+/* Can this word be part of a superblock? */
+static int
+fusable(struct ucdec *uc)
+{
+	if (uc->fn != th_alu)
+		return 0;
+	if (uc->b == 010 || uc->b > 015 || uc->dest == 015)
+		return 0;	// not implemented, let arith() complain
+	return 1;
+}
+
+static void
+mkblocks(struct nd10 *c)
+{
+	int i;
+
+	for (i = 4095; i >= 0; i--) {
+		if (fusable(&c->utab[i]) == 0)
+			c->utab[i].blen = 0;
+		else if (i < 4095)
+			c->utab[i].blen = c->utab[i+1].blen + 1;
+		else
+			c->utab[i].blen = 1;
+	}
+}
+
+/*
+ * Execute the superblock starting at uc.  Returns number of steps.
+ */
+static int
+ublock(struct nd10 *c, struct ucdec *uc)
+{
+	int n = uc->blen, lvl = c->pil, i;
+	int aval, bval, dval;
+	Reg r[16];
+
+	r[000] = 0;
+	r[001] = c->D[lvl];
+	r[002] = c->CP;
+	r[003] = c->B[lvl];
+	r[004] = c->L[lvl];
+	r[005] = c->A[lvl];
+	r[006] = c->T[lvl];
+	r[007] = c->X[lvl];
+	r[010] = c->STS[lvl];
+	r[011] = SEXT8(c->H);	// H cannot change in a block
+	r[012] = 0;
+	r[013] = c->H;
+	r[014] = c->S1[lvl];
+	r[015] = c->R;
+	r[016] = c->SP[lvl];
+	r[017] = c->S2[lvl];
+
+	for (i = 0; i < n; i++, uc++) {
+		aval = c->Alatch[uc->arsel] = r[uc->a];
+		if (uc->b < 010)
+			bval = r[uc->b];
+		else
+			bval = breg(c, uc, lvl);	// SH and AC
+		if (ckcond(c, uc) == 0)
+			continue;
+		dval = alu181(c, uc, aval, bval,
+		    (r[010] & STS_C) != 0, uc->arsel);
+		if (uc->ssave) {
+			r[010] &= ~(STS_C|STS_Q);
+			if (c->bC) r[010] |= STS_C;
+			if (c->bO) r[010] |= (STS_O|STS_Q);
+		}
+		dval &= 0177777;
+		c->AC[uc->arsel] = dval;
+		switch (uc->dest) {
+		case 000: break;
+		case 010: r[010] = dval & 0377; break;
+		case 011: c->SH[uc->arsel] = dval; break;
+		case 013:
+			c->SC = dval & 077;
+			if (c->SC > 037) c->SC |= (0xffffffff << 6);
+			break;
+		default: r[uc->dest] = dval; break;
+		}
+	}
+
+	c->D[lvl] = r[001];
+	c->CP = r[002];
+	c->B[lvl] = r[003];
+	c->L[lvl] = r[004];
+	c->A[lvl] = r[005];
+	c->T[lvl] = r[006];
+	c->X[lvl] = r[007];
+	c->STS[lvl] = r[010];
+	c->S1[lvl] = r[014];
+	c->SP[lvl] = r[016];
+	c->S2[lvl] = r[017];
+	c->mpc += n;
+	return n;
+}
+
+static void
+runblk(struct nd10 *c, long nsteps)
+{
+	struct ucdec *ud;
+
+	if (nsteps < 0)
+		nsteps = LONG_MAX;
+	while (nsteps > 0) {
+		c->frmpc[c->frun++ & (FRSTEPS-1)] = c->mpc;	// a block as one
+		ud = &c->utab[c->mpc];
+		if (ud->blen > 1) {
+			nsteps -= ublock(c, ud);
+		} else {
+			(*ud->fn)(c, ud);
+			nsteps--;
+		}
+	}
+}
+
+/*
+ * Native interpreter for the macro instruction set, used with -n.
+ *
+ * The handlers are attached to microcode entry points and each one is
+ * written from the microcode routine at its entry, so an instruction
+ * is only executed natively if the microcode would have executed that
+ * routine for it.  Anything else (floating point, MPY, RMPY/RDIV, EXR,
+ * WAIT, level and paging control, ...) is left to the microcode.  A
+ * handler may also return 0 before changing anything to decline.  With
+ * paging on everything is, as only the memory cycles translate.
+ *
+ * Registers, STS, mem[] and the interrupt and I/O state end up as the
+ * microcode would leave them.  The microcode scratch registers (H, R,
+ * AC, SH, SC, S1, S2 and SP of the current level) are not maintained.
+ */
+
+/* register numbering in ROP, SKP and BOP */
+static inline int
+nget(struct nd10 *c, int r)
+{
+	switch (r & 7) {
+	case 1: return c->D[c->pil];
+	case 2: return c->CP;
+	case 3: return c->B[c->pil];
+	case 4: return c->L[c->pil];
+	case 5: return c->A[c->pil];
+	case 6: return c->T[c->pil];
+	case 7: return c->X[c->pil];
+	}
+	return 0;
+}
+
+static inline void
+nput(struct nd10 *c, int r, int v)
+{
+	switch (r & 7) {
+	case 1: c->D[c->pil] = v; break;
+	case 2: c->CP = v; break;
+	case 3: c->B[c->pil] = v; break;
+	case 4: c->L[c->pil] = v; break;
+	case 5: c->A[c->pil] = v; break;
+	case 6: c->T[c->pil] = v; break;
+	case 7: c->X[c->pil] = v; break;
+	}
+}
+
+/*
+ * Add with the flags of the ALU with SSAVE set.  b is the ALU B input,
+ * na the (possibly inverted) A input, cin the carry in.
+ */
+static inline int
+nadd(struct nd10 *c, int b, int na, int cin)
+{
+	int d = b + na + cin;
+
+	c->STS[c->pil] &= ~(STS_C|STS_Q);
+	if (d > 0177777)
+		c->STS[c->pil] |= STS_C;
+	if (!BIT15(b ^ na) && BIT15(b ^ d))
+		c->STS[c->pil] |= (STS_O|STS_Q);
+	return d & 0177777;
+}
+
+/*
+ * Memory write, seen by lockstep.  Paging is off here, but a store at
+ * SHADOW and up also sets the page table (see vwrite()), so the
+ * handlers decline those and leave them to the microcode; n is the
+ * number of words from ea.
+ */
+#define	NSHADOW(ea, n)	((ea) + (n) - 1 >= SHADOW)
+
+static inline void
+nst(struct nd10 *c, int ea, int v)
+{
+	if (c->lsarm)
+		lslog(c, ea);
+	c->mem[ea] = v;
+}
+
+/* STZ, STA, STT, STX */
+static inline int
+nst1(struct nd10 *c, int v)
+{
+	int ea = calcea(c);
+
+	if (NSHADOW(ea, 1))
+		return 0;
+	nst(c, ea, v);
+	return 1;
+}
+
+static int n_stz(struct nd10 *c) { return nst1(c, 0); }
+static int n_sta(struct nd10 *c) { return nst1(c, c->A[c->pil]); }
+static int n_stt(struct nd10 *c) { return nst1(c, c->T[c->pil]); }
+static int n_stx(struct nd10 *c) { return nst1(c, c->X[c->pil]); }
+static int n_lda(struct nd10 *c) { c->A[c->pil] = c->mem[calcea(c)]; return 1; }
+static int n_ldt(struct nd10 *c) { c->T[c->pil] = c->mem[calcea(c)]; return 1; }
+static int n_ldx(struct nd10 *c) { c->X[c->pil] = c->mem[calcea(c)]; return 1; }
+static int n_and(struct nd10 *c) { c->A[c->pil] &= c->mem[calcea(c)]; return 1; }
+static int n_ora(struct nd10 *c) { c->A[c->pil] |= c->mem[calcea(c)]; return 1; }
+static int n_jmp(struct nd10 *c) { c->CP = calcea(c); return 1; }
+
+static int
+n_std(struct nd10 *c)
+{
+	int ea = calcea(c);
+
+	if (NSHADOW(ea, 2))
+		return 0;
+	nst(c, ea, c->A[c->pil]);
+	nst(c, (ea + 1) & 0177777, c->D[c->pil]);
+	return 1;
+}
+
+static int
+n_ldd(struct nd10 *c)
+{
+	int ea = calcea(c);
+
+	c->A[c->pil] = c->mem[ea];
+	c->D[c->pil] = c->mem[(ea + 1) & 0177777];
+	return 1;
+}
+
+static int
+n_stf(struct nd10 *c)
+{
+	int ea = calcea(c);
+
+	if (NSHADOW(ea, 3))
+		return 0;
+	nst(c, ea, c->T[c->pil]);
+	nst(c, (ea + 1) & 0177777, c->A[c->pil]);
+	nst(c, (ea + 2) & 0177777, c->D[c->pil]);
+	return 1;
+}
+
+static int
+n_ldf(struct nd10 *c)
+{
+	int ea = calcea(c);
+
+	c->T[c->pil] = c->mem[ea];
+	c->A[c->pil] = c->mem[(ea + 1) & 0177777];
+	c->D[c->pil] = c->mem[(ea + 2) & 0177777];
+	return 1;
+}
+
+static int
+n_min(struct nd10 *c)
+{
+	int ea = calcea(c);
+
+	if (NSHADOW(ea, 1))
+		return 0;
+	nst(c, ea, c->mem[ea] + 1);
+	if (c->mem[ea] == 0)
+		c->CP++;
+	return 1;
+}
+
+static int
+n_add(struct nd10 *c)
+{
+	c->A[c->pil] = nadd(c, c->A[c->pil], c->mem[calcea(c)], 0);
+	return 1;
+}
+
+static int
+n_sub(struct nd10 *c)
+{
+	c->A[c->pil] = nadd(c, c->A[c->pil], (Reg)~c->mem[calcea(c)], 1);
+	return 1;
+}
+
+static int
+n_jpl(struct nd10 *c)
+{
+	c->L[c->pil] = c->CP;
+	c->CP = calcea(c);
+	return 1;
+}
+
+/* JAP, JAN, JAZ, JAF, JPC, JNC, JXZ, JXN */
+static int
+n_jcond(struct nd10 *c)
+{
+	int op = (c->IR >> 8) & 7, v, j;
+
+	if (op == 4 || op == 5)		// JPC, JNC count first
+		c->X[c->pil]++;
+	v = op < 4 ? c->A[c->pil] : c->X[c->pil];
+	switch (op) {
+	case 0: case 4: j = !BIT15(v); break;
+	case 1: case 5: case 7: j = BIT15(v); break;
+	case 2: case 6: j = v == 0; break;
+	case 3: j = v != 0; break;
+	}
+	if (j)
+		c->CP = calcea(c);
+	return 1;
+}
+
+/* flags as from B-A in the ALU, tested as by ckcond() */
+static int
+nskp(struct nd10 *c)
+{
+	Reg a = nget(c, c->IR >> 3), b = nget(c, c->IR), na = ~a;
+	int d = b + na + 1, n;
+
+	switch ((c->IR >> 8) & 3) {
+	case 0: n = (d & 0177777) == 0; break;
+	case 1: n = BIT15(d) == 0; break;
+	case 2: n = (BIT15(d) ^ (!BIT15(b ^ na) && BIT15(b ^ d))) == 0; break;
+	case 3: n = d > 0177777; break;
+	}
+	if (c->IR & 02000)
+		n = !n;
+	return n;
+}
+
+static int
+n_skp(struct nd10 *c)
+{
+	if (nskp(c))
+		c->CP++;
+	return 1;
+}
+
+static int
+n_lbyt(struct nd10 *c)
+{
+	int w = c->mem[(c->T[c->pil] + (c->X[c->pil] >> 1)) & 0177777];
+
+	c->A[c->pil] = (c->X[c->pil] & 1) ? w & 0377 : w >> 8;
+	return 1;
+}
+
+static int
+n_sbyt(struct nd10 *c)
+{
+	int ea = (c->T[c->pil] + (c->X[c->pil] >> 1)) & 0177777;
+
+	if (NSHADOW(ea, 1))
+		return 0;
+	if (c->X[c->pil] & 1)
+		nst(c, ea, (c->mem[ea] & 0177400) | (c->A[c->pil] & 0377));
+	else
+		nst(c, ea, (c->mem[ea] & 0377) | (c->A[c->pil] << 8));
+	return 1;
+}
+
+static int
+n_mix3(struct nd10 *c)
+{
+	c->X[c->pil] = (c->A[c->pil] - 1) * 3;
+	return 1;
+}
+
+/* SWAP, done in the same steps as the microcode in case sr == dr */
+static int
+n_swap(struct nd10 *c)
+{
+	int sr = c->IR >> 3, dr = c->IR, v;
+
+	if (c->IR & 0200)			// CM1
+		nput(c, sr, ~nget(c, sr));
+	v = nget(c, sr);
+	nput(c, sr, nget(c, dr));
+	nput(c, dr, v);
+	return 1;
+}
+
+/* ROP, both logical and arithmetic */
+static int
+n_rop(struct nd10 *c)
+{
+	Reg a = nget(c, c->IR >> 3), b = (c->IR & 0100) ? 0 : nget(c, c->IR);
+	int cin = (c->STS[c->pil] & STS_C) != 0;
+	int d;
+
+	switch ((c->IR >> 7) & 017) {
+	case 002: d = a & b; break;		// RAND
+	case 003: d = ~a & b; break;		// RAND CM1
+	case 004: d = a ^ b; break;		// REXO
+	case 006: d = a | b; break;		// RORA
+	case 010: d = nadd(c, b, a, 0); break;	// RADD
+	case 011: d = nadd(c, b, (Reg)~a, 0); break;	// CM1
+	case 012: case 016: d = nadd(c, b, a, 1); break;	// AD1
+	case 013: case 017: d = nadd(c, b, (Reg)~a, 1); break; // RSUB
+	case 014: d = nadd(c, b, a, cin); break;	// ADC
+	case 015: d = nadd(c, b, (Reg)~a, cin); break;	// ADC CM1
+	default: return 0;			// not in microcode
+	}
+	nput(c, c->IR, d);
+	return 1;
+}
+
+static int
+n_tra(struct nd10 *c)
+{
+	struct ucdec u;
+
+	u.b = c->IR & 017;
+	u.line = 0;
+	if (c->lsarm && (u.b == 006 || ((c->IR & 0300) && (u.b == 004 ||
+	    u.b == 007))))
+		return 0;	// intcalc() takes lines lockstep cannot put back
+	switch (c->IR & 0300) {
+	case 0000:	// TRA
+		if (u.b == 0 || u.b == 014 || u.b == 017)
+			return 0;
+		tra(c, &u);
+		c->A[c->pil] = c->H;
+		break;
+	case 0100:	// TRR, not to the microcode's own 013 (CAR) and up
+		if (u.b > 007)
+			return 0;
+		trr(c, &u, c->A[c->pil]);
+		break;
+	case 0200:	// MCL
+	case 0300:	// MST
+		if (u.b == 0 || u.b > 007)
+			return 0;
+		tra(c, &u);
+		trr(c, &u,
+		    (c->IR & 0100) ? (c->H | c->A[c->pil]) : (c->H & ~c->A[c->pil]));
+		break;
+	}
+	return 1;
+}
+
+/* SHT, SHD, SHA, SAD, as the LOOP in the microcode */
+static int
+n_shift(struct nd10 *c)
+{
+	int sc = c->IR & 077, typ = (c->IR >> 9) & 3, m, x;
+	int dbl = (c->IR & 0600) == 0600;
+	Reg sh1, sh0 = c->D[c->pil];
+
+	switch (c->IR & 0600) {
+	case 0000: sh1 = c->T[c->pil]; break;
+	case 0200: sh1 = c->D[c->pil]; break;
+	default: sh1 = c->A[c->pil]; break;
+	}
+	if (sc > 037)
+		sc = 0100 - sc;
+	for (; sc > 0; sc--) {
+		if ((c->IR & 040) == 0) {	// left
+			m = BIT15(sh1);
+			x = typ == 1 ? m : typ == 3 ? (c->STS[c->pil] & STS_M) != 0 : 0;
+			if (dbl) {
+				sh1 = (sh1 << 1) | BIT15(sh0);
+				sh0 = (sh0 << 1) | x;
+			} else
+				sh1 = (sh1 << 1) | x;
+		} else {
+			m = dbl ? sh0 & 1 : sh1 & 1;
+			switch (typ) {
+			case 0: x = BIT15(sh1); break;
+			case 1: x = m; break;
+			case 2: x = 0; break;
+			case 3: x = (c->STS[c->pil] & STS_M) != 0; break;
+			}
+			if (dbl)
+				sh0 = (sh0 >> 1) | (sh1 << 15);
+			sh1 = (sh1 >> 1) | (x << 15);
+		}
+		c->STS[c->pil] &= ~STS_M;
+		if (m) c->STS[c->pil] |= STS_M;
+	}
+	switch (c->IR & 0600) {
+	case 0000: c->T[c->pil] = sh1; break;
+	case 0200: c->D[c->pil] = sh1; break;
+	case 0400: c->A[c->pil] = sh1; break;
+	case 0600: c->A[c->pil] = sh1; c->D[c->pil] = sh0; break;
+	}
+	return 1;
+}
+
+static int
+n_iox(struct nd10 *c)
+{
+	c->ioreg = c->A[c->pil];
+	ioexec(c, NULL);
+	c->A[c->pil] = c->ioreg;
+	return 1;
+}
+
+static const int nsareg[] = { 3, 5, 6, 7 };	/* B, A, T, X */
+
+/* SAB, SAA, SAT, SAX */
+static int
+n_sa(struct nd10 *c)
+{
+	nput(c, nsareg[(c->IR >> 8) & 3], SEXT8(c->IR));
+	return 1;
+}
+
+/* AAB, AAA, AAT, AAX */
+static int
+n_aa(struct nd10 *c)
+{
+	int r = nsareg[(c->IR >> 8) & 3];
 
-	cycles(ucb, aval);
+	nput(c, r, nadd(c, nget(c, r), SEXT8(c->IR) & 0177777, 0));
+	return 1;
+}
 
-	if (M_SSAVE(ucb)) {
-		printf("\n");
-		errx(1, "iblock ssave 0%o not implemented: %08X line %o", M_SSAVE(ucb), uc->line, mpc);
+/* BSET, BSKP, BSTC, BSTA, BLDC, BLDA, BANC, BAND, BORC, BORA */
+static int
+n_bop(struct nd10 *c)
+{
+	int r = c->IR & 7, bit = 1 << ((c->IR >> 3) & 017);
+	int v = r ? nget(c, r) : c->STS[c->pil];
+	int k = (c->STS[c->pil] & 04) != 0;
+	int b = (v & bit) != 0, nb = -1, nk = -1;
+
+	switch ((c->IR >> 7) & 017) {
+	case 000: nb = 0; break;		// BSET ZRO
+	case 001: nb = 1; break;		// BSET ONE
+	case 002: nb = !b; break;		// BSET BCM
+	case 003: nb = k; break;		// BSET BAC
+	case 004: if (b == 0) c->CP++; break;	// BSKP ZRO
+	case 005: if (b) c->CP++; break;		// BSKP ONE
+	case 006: if (b != k) c->CP++; break;	// BSKP BCM
+	case 007: if (b == k) c->CP++; break;	// BSKP BAC
+	case 010: nb = !k; nk = 1; break;	// BSTC
+	case 011: nb = k; nk = 0; break;	// BSTA
+	case 012: nk = !b; break;		// BLDC
+	case 013: nk = b; break;		// BLDA
+	case 014: nk = k & !b; break;		// BANC
+	case 015: nk = k & b; break;		// BAND
+	case 016: nk = k | !b; break;		// BORC
+	case 017: nk = k | b; break;		// BORA
+	}
+	if (nb >= 0) {
+		v = nb ? v | bit : v & ~bit;
+		if (r)
+			nput(c, r, v);
+		else
+			c->STS[c->pil] = v;
 	}
+	if (nk >= 0)
+		c->STS[c->pil] = nk ? c->STS[c->pil] | 04 : c->STS[c->pil] & ~04;
+	return 1;
 }
 
-#define EJUMP(x) if (uc->x) { printf("\n");	\
-	errx(1, "jump " #x " 0%o not implemented: %08X line %o", uc->x, uc->line, mpc); }
+/*
+ * Handlers by microcode entry point.
+ */
+static struct {
+	int entry;
+	nfn_t fn;
+} nents[] = {
+	{ 0100, n_stz }, { 0102, n_sta }, { 0104, n_stt }, { 0106, n_stx },
+	{ 0110, n_std }, { 0112, n_ldd }, { 0114, n_stf }, { 0116, n_ldf },
+	{ 0120, n_min }, { 0122, n_lda }, { 0124, n_ldt }, { 0126, n_ldx },
+	{ 0130, n_add }, { 0132, n_sub }, { 0134, n_and }, { 0136, n_ora },
+	{ 0152, n_jmp }, { 0156, n_jpl }, { 0172, n_iox },
+	{ 0200, n_skp }, { 0211, n_lbyt }, { 0213, n_sbyt }, { 0215, n_mix3 },
+	{ 0220, n_swap }, { 0221, n_swap }, { 0222, n_rop }, { 0223, n_rop },
+	{ 0224, n_rop }, { 0226, n_rop }, { 0230, n_rop }, { 0231, n_rop },
+	{ 0232, n_rop }, { 0233, n_rop }, { 0234, n_rop }, { 0235, n_rop },
+	{ 0236, n_rop }, { 0237, n_rop }, { 0240, n_tra },
+	{ 0260, n_shift }, { 0264, n_shift }, { 0270, n_shift },
+	{ 0274, n_shift },
+	{ 0300, n_jcond }, { 0302, n_jcond }, { 0304, n_jcond },
+	{ 0306, n_jcond }, { 0310, n_jcond }, { 0312, n_jcond },
+	{ 0314, n_jcond }, { 0316, n_jcond },
+	{ 0340, n_sa }, { 0342, n_sa }, { 0344, n_sa }, { 0346, n_sa },
+	{ 0350, n_aa }, { 0352, n_aa }, { 0354, n_aa }, { 0356, n_aa },
+	{ 0360, n_bop }, { 0361, n_bop }, { 0362, n_bop }, { 0363, n_bop },
+	{ 0364, n_bop }, { 0365, n_bop }, { 0366, n_bop }, { 0367, n_bop },
+	{ 0370, n_bop }, { 0371, n_bop }, { 0372, n_bop }, { 0373, n_bop },
+	{ 0374, n_bop }, { 0375, n_bop }, { 0376, n_bop }, { 0377, n_bop },
+};
 
-void
-jump(union ucent *uc)
+static void
+ninit(void)
 {
-	int true;
+	int i, j;
 
-	if (M_PRIV(uc)) {
-		if (pgon) {
-			if (M_PRIV(uc)) { printf("\n");	\
-	errx(1, "jump priv 0%o not implemented: %08X line %o", M_PRIV(uc), uc->line, mpc); }
-		}
-	}
-	true = ckcond(uc);
-	if (true)
-		mpc = M_CAR(uc) ? CAR : M_ADDR(uc);
-	else
-		mpc++;
-	if (tflag)
-		fprintf(tfp, " %sJMP to %o", M_JCOND(uc) ? "C" : "", mpc);
+	for (i = 0; i < EPGTABSZ; i++)
+		for (j = 0; j < (int)(sizeof(nents)/sizeof(nents[0])); j++)
+			if (nents[j].entry == epgtab[i])
+				ntab[i] = nents[j].fn;
 }
 
 /*
- * Loop instruction ALU ops reads from B, does something and saves in AC.
+ * Lockstep (-L).  Each fetched instruction that has a native handler
+ * is first executed natively, the result saved and then undone, and
+ * the microcode left to execute it.  At the next fetch cycle the two
+ * results are compared: registers of all levels (except the scratch
+ * ones), STS, CP, interrupt state and the memory words written by
+ * either.  IOX is not run natively here since the device would see
+ * it twice.
  */
-void	
-loop(union ucent *uc)
+static void
+cpsave(struct nd10 *c, struct cpstate *s)
 {
-	union ucent ucb;
-	int m, xbit, shright;
-	int bvm, bvl, aclbit = 0;
-
-	shright = M_LORSHT(uc) ? (IR & 040) : M_LSHR(uc);
-
-	// 1 == rotational, 2 == zero input
-	int shtyp = M_LORSHT(uc) ? (IR >> 9) & 3 : M_LSHT(uc);
-
-	for (;;) {
-		if (M_TERM(uc) == 0 && SC == 0)
-			break;
-		if (M_TERM(uc) == 2 && (SC == 0 || (SH[1] & 0100000)))
-			break;
-		if (M_TERM(uc) == 3 && (SC == 0 || (SH[1] & 0000100)))
-			break;
-
-		unsigned int ACL, ALL;
-
-		ALL = (Alatch[1] << 16) | Alatch[0];
-		ACL = (AC[1] << 16) | AC[0];
-
-		switch (M_LB(uc)) {
-		case 0: ACL = 0; break;
-		case 013: break;
-		case 014: 
-			ACL >>= 1;
-			ACL |= (aclbit << 31);
-			// XXX input fr}n ALU???
-			break;
-
-		case 015:
-			ACL <<= 1;
-			// XXX
-			break;
-
-		default: 
-			errx(1, "unspec B reg %02o", M_LB(uc));
-		}
-
-		int alucmd = M_LALUM(uc);
-		if ((M_LALT(uc) && BIT0(SH[0])) ||
-		    ((M_LALT(uc) == 0) && BIT15(SH[1])))
-			alucmd = M_LALUL(uc);
-
-		int acsign = BIT15(AC[1]); // before calculations
-		ull ACLlong;
-		unsigned int acinv = ~ALL;
-		Reg ACold;
-		switch (alucmd) {
-		case 00: ACLlong = ACL-1; break;	// BM1
-		case 01: ACLlong = (ull)ACL + (ull)ALL; break;// PLUS
-		case 03: ACLlong = ACL;	break;			// BD1
-		case 016:
-			ACLlong = (ull)ACL + (ull)acinv + 1;
-			break;
-		default:
-			errx(1, "bad cmd %02o", alucmd);
-		}
+	memset(s, 0, sizeof(*s));	// compared with memcmp
+	memcpy(s->A, c->A, sizeof(Rblk));
+	memcpy(s->D, c->D, sizeof(Rblk));
+	memcpy(s->T, c->T, sizeof(Rblk));
+	memcpy(s->X, c->X, sizeof(Rblk));
+	memcpy(s->B, c->B, sizeof(Rblk));
+	memcpy(s->L, c->L, sizeof(Rblk));
+	memcpy(s->STS, c->STS, sizeof(c->STS));
+	s->CP = c->CP; s->H = c->H; s->CAR = c->CAR; s->PCR = c->PCR;
+	s->ioreg = c->ioreg;
+	s->pil = c->pil; s->pid = c->pid; s->pie = c->pie; s->iie = c->iie;
+	s->iid = c->iid; s->iic = c->iic; s->pgon = c->pgon;
+	s->inton = c->inton;
+}
 
-		AC[1] = ACLlong >> 16;
-		AC[0] = ACLlong;
-		aclbit = ACLlong > 0xffffffffULL;
-		bZ = AC[1] == 0;
-		bC = aclbit;
-		bS = BIT15(AC[1]);
-		bO = BIT15(alucmd == 016 ? acinv : ALL) ^ BIT15(ACold);
-		bO = ((bO == 0) && BIT15(ACold ^ ACLlong));
-		if (M_LSSAVE(uc)) {
-			STS[pil] &= ~(STS_C|STS_Q);
-			if (bC) STS[pil] |= STS_C;
-			if (bO) STS[pil] |= (STS_O|STS_Q);
-		}
+static void
+cprestore(struct nd10 *c, struct cpstate *s)
+{
+	memcpy(c->A, s->A, sizeof(Rblk));
+	memcpy(c->D, s->D, sizeof(Rblk));
+	memcpy(c->T, s->T, sizeof(Rblk));
+	memcpy(c->X, s->X, sizeof(Rblk));
+	memcpy(c->B, s->B, sizeof(Rblk));
+	memcpy(c->L, s->L, sizeof(Rblk));
+	memcpy(c->STS, s->STS, sizeof(c->STS));
+	c->CP = s->CP; c->H = s->H; c->CAR = s->CAR; c->PCR = s->PCR;
+	c->ioreg = s->ioreg;
+	c->pil = s->pil; c->pid = s->pid; c->pie = s->pie; c->iie = s->iie;
+	c->iid = s->iid; c->iic = s->iic; c->pgon = s->pgon;
+	c->inton = s->inton;
+	intlevel(c);		// the lines posted meanwhile are left for later
+}
 
-		switch (M_TG(uc)) {
-		case 0: break;
-		case 1: if (SH[0] & 1) STS[pil] |= STS_TG; break;
-		case 2: if (AC[0] & 1) STS[pil] |= STS_TG; break;
-		case 3: if ((AC[0] | AC[1]) == 0) STS[pil] |= STS_TG; break;
-		}
+/* remember the old contents of a word about to be written */
+static void
+lslog(struct nd10 *c, int a)
+{
+	struct lslog *l = &c->lsl[c->lsarm-1];
 
+	if (l->n < NLSLOG) {
+		l->addr[l->n] = a;
+		l->old[l->n] = c->mem[a];
+	}
+	l->n++;
+}
 
-		if (shright == 0) { // shift left
-			m = (SH[1] & 0100000) != 0;
-			/* defined at 1062 lower left */
-			if (M_ENDID(uc)) {	// shift left input
-				if (acsign) {
-					xbit = bC ? 1 : BIT0(SH[0]);
-				} else
-					xbit = bC ? BIT0(SH[0]) : 0;
-			} else {
-				switch (shtyp) {
-				case 2: case 0: xbit = 0; break;
-				case 1: xbit = m; break;
-				case 3: xbit = ((STS[pil] & STS_M) != 0); break;
-				}
-			}
-			if (M_LSH32(uc)) { // Combined shift
-				SH[1] = (SH[1] << 1) | BIT15(SH[0]);
-				SH[0] = (SH[0] << 1) | xbit;
-			} else
-				SH[1] = (SH[1] << 1) | xbit;
-		} else {
-			m = M_LSH32(uc) ? SH[0] & 1 : SH[1] & 1;
-			switch (shtyp) {
-			case 0: xbit = (SH[1] & 0100000) != 0; break;
-			case 1: xbit = m; break;
-			case 2: xbit = 0; break;
-			case 3: xbit = ((STS[pil] & STS_M) != 0); break;
-			}
-			if (M_LSH32(uc)) {
-				SH[0] = (SH[0] >> 1) | (SH[1] << 15);
-				SH[1] = (SH[1] >> 1) | (xbit << 15);
-			} else
-				SH[1] = (SH[1] >> 1) | (xbit << 15);
-		}
-		if (M_LM(uc)) {
-			STS[pil] &= ~STS_M;
-			if (m) STS[pil] |= STS_M;
-		}
+static void
+lsstart(struct nd10 *c, nfn_t fn)
+{
+	struct lslog *l = &c->lsl[0];
+	int i;
 
-		if (SC < 0)
-			SC++;
-		else
-			SC--;
+	cpsave(c, &c->hist[c->lsinsn % NHIST]);
+	c->hist[c->lsinsn++ % NHIST].CP = c->oldCP;
+	if (fn == NULL || fn == n_iox)
+		return;
+	cpsave(c, &c->lsbefore);
+	c->lsl[0].n = c->lsl[1].n = 0;
+	c->lsarm = 1;
+	if ((*fn)(c) == 0) {
+		c->lsarm = 0;
+		return;
+	}
+	cpsave(c, &c->lsnat);
+	for (i = l->n - 1; i >= 0; i--) {
+		l->new[i] = c->mem[l->addr[i]];
+		c->mem[l->addr[i]] = l->old[i];
 	}
+	cprestore(c, &c->lsbefore);
+	c->lsarm = 2;
+}
+
+static void
+lsprint(char *s, struct cpstate *p)
+{
+	fprintf(stderr, "%-10s %06o: IR=%06o STS=%06o D=%06o B=%06o "
+	    "L=%06o A=%06o T=%06o X=%06o\n", s, p->CP, p->CAR,
+	    p->STS[p->pil] + (p->pil << 8) + (p->inton << 15),
+	    p->D[p->pil], p->B[p->pil], p->L[p->pil],
+	    p->A[p->pil], p->T[p->pil], p->X[p->pil]);
 }
 
-int ttostat = 010;
-FILE *ptrfp;
-unsigned char ptr_char;
-int ptr_intr;
+/* compare the microcode result with the native one */
+static void
+lscheck(struct nd10 *c)
+{
+	struct cpstate m;
+	struct lslog *nl = &c->lsl[0], *ml = &c->lsl[1];
+	int i, j, bad = 0;
+
+	c->lsarm = 0;
+	cpsave(c, &m);
+	m.H = c->lsnat.H;
+	m.CAR = c->lsnat.CAR;
+	if (memcmp(&m, &c->lsnat, sizeof(m)))
+		bad = 1;
+	if (ml->n > NLSLOG)
+		bad = 1;
+	for (i = 0; i < nl->n; i++)
+		if (c->mem[nl->addr[i]] != nl->new[i])
+			bad = 1;
+	for (i = 0; i < ml->n && i < NLSLOG; i++) {
+		for (j = 0; j < nl->n; j++)
+			if (nl->addr[j] == ml->addr[i])
+				break;
+		if (j == nl->n && c->mem[ml->addr[i]] != ml->old[i])
+			bad = 1;
+	}
+	if (bad == 0)
+		return;
 
-static int incnt;
+	fprintf(stderr, "\nlockstep: differs after %06o at instruction %ld\n",
+	    c->lsbefore.CAR, c->icount);
+	for (i = c->lsinsn > NHIST ? c->lsinsn - NHIST : 0; i < c->lsinsn; i++)
+		lsprint("", &c->hist[i % NHIST]);
+	lsprint("microcode", &m);
+	lsprint("native", &c->lsnat);
+#define	LSREG(r) for (i = 0; i < 16; i++) if (m.r[i] != c->lsnat.r[i]) \
+	fprintf(stderr, "%s[%d]: microcode %06o native %06o\n", \
+	    #r, i, m.r[i], c->lsnat.r[i])
+	LSREG(A); LSREG(D); LSREG(T); LSREG(X); LSREG(B); LSREG(L); LSREG(STS);
+#define	LSVAR(r) if (m.r != c->lsnat.r) \
+	fprintf(stderr, "%s: microcode %06o native %06o\n", #r, \
+	    m.r, c->lsnat.r)
+	LSVAR(CP); LSVAR(PCR); LSVAR(ioreg); LSVAR(pil); LSVAR(pid);
+	LSVAR(pie); LSVAR(iie); LSVAR(iid); LSVAR(iic); LSVAR(pgon);
+	LSVAR(inton);
+	for (i = 0; i < nl->n; i++)
+		fprintf(stderr, "native wrote %06o: %06o (now %06o)\n",
+		    nl->addr[i], nl->new[i], c->mem[nl->addr[i]]);
+	for (i = 0; i < ml->n && i < NLSLOG; i++)
+		fprintf(stderr, "microcode wrote %06o: %06o\n",
+		    ml->addr[i], c->mem[ml->addr[i]]);
+	uerrx(c, "lockstep failed");
+}
 
 void
-ioexec(union ucent *uc)
+ioexec(struct nd10 *c, struct ucdec *uc)
 {
-	int i;
+	int i, dev = c->CAR & 03777;
 	char inchar;
 
-	if (tflag)
-		fprintf(tfp, " iox %o", CAR & 03777);
-	switch (CAR & 03777) {
+	if (c->tflag)
+		triox(dev);
+	if (dev != 0302)
+		c->idlen = 0;
+	switch (dev) {
 	case 0011: // clear counter
-		rtc_ctr = 10000; // something
+		rtcsched(c, c->icount + RTCTICK);
 		break;
 
 	case 0013: // Set RTC status
-		if (BIT0(ioreg))  rtc_doint = 1;
-		if (BIT13(ioreg)) rtc_rft = 0;
+		if (BIT0(c->ioreg))  c->rtc_doint = 1;
+		if (BIT13(c->ioreg) && c->rtc_rft) {
+			c->rtc_rft = 0;
+			intdrop(c, 13);
+			intcalc(c);
+		}
 		break;
 
 	case 0300:
-		if (ifd) {
-			if ((i = fgetc(ifd)) == EOF) {
-				fclose(ifd);
-				ifd = NULL;
+		if (c->playfp) {
+			inplay(c, dev);
+			break;
+		}
+		if (c->ifd) {
+			if ((i = fgetc(c->ifd)) == EOF) {
+				fclose(c->ifd);
+				c->ifd = NULL;
 			} else {
 				if (i == 10) i = 13;
-				ioreg = (unsigned char)i;
+				c->ioreg = (unsigned char)i;
+				c->ttistat &= ~010;
 				break;
 			}
 		}
 
-		if ((i = read(sfd, &inchar, 1)) < 0)
-			return;
-		ttistat &= ~010;
-		ioreg = inchar;
+		c->ttistat &= ~010;
+		if (conon && (i = conget(&conin)) >= 0)	// not after ifd
+			c->ioreg = i;
 		break;
 
 	case 0302:				// Read status
-		if (ifd)
-			sig_io(0);
-		ioreg = ttistat;
+		if (c->playfp) {
+			inplay(c, dev);
+		} else {
+			if (c->ifd && (i = fgetc(c->ifd)) != EOF) {
+				ungetc(i, c->ifd);
+				c->ttistat |= 010;
+			} else if (conon && conlen(&conin))
+				c->ttistat |= 010;
+			c->ioreg = c->ttistat;
+			if (c->ioreg == c->idlest &&
+			    c->icount - c->idleic <= IDLEGAP &&
+			    ++c->idlen == IDLEPOLLS) {
+				c->idlen = 0;
+				if (ckstuck(c, 1))
+					ckend(c, "waits for input");
+				idle(c);
+			}
+			c->idlest = c->ioreg;
+			c->idleic = c->icount;
+		}
+		if (snapreq && uc)	// console polls here without fetching
+			snapshot(c);
+		if (frreq)
+			frsig(c);
 		break;
 
-	case 0303: break;			// Set tti/tto param
+	case 0303:				// Set tti/tto param
+		c->tti_active = c->ioreg;
+		ttiset(c);
+		break;
 
 	case 0305:
-		inchar = ioreg;
-		printf("%c", inchar); fflush(stdout);
+		inchar = c->ioreg;
+		if (conon)
+			conputc(inchar);
+		else {
+			putc(inchar, c->ofp);
+			fflush(c->ofp);
+		}
 		break;
 
-	case 0306: ioreg = ttostat; break;	// read status
+	case 0306: c->ioreg = c->ttostat; break;	// read status
 
 	case 0307: break;			//
 
 	case 0400: // read char
-		ioreg = ptr_char;
+		if (c->playfp) {
+			inplay(c, dev);
+			break;
+		}
+		c->ioreg = c->ptr_char;
 		break;
 
 	case 0402: // read ptr status
-		ioreg = ptr_intr;
-		if (ptrfp) {
-			if ((i = fgetc(ptrfp)) == EOF) {
-				fclose(ptrfp);
-				ptrfp = NULL;
-			} else {
-				ptr_char = i;
-				ioreg |= 010; // Ready for transfer
+		if (c->playfp) {
+			inplay(c, dev);
+			break;
+		}
+		c->ioreg = c->ptr_intr;
+		if (c->ptrimg) {
+			if (c->ptrpos >= c->ptrlen)
+				ptrclose(c);
+			else {
+				c->ptr_char = c->ptrimg[c->ptrpos++];
+				c->ioreg |= 010; // Ready for transfer
 			}
 		}
 		break;
 
 	case 0403: // set ptr status
-		ptr_intr = ioreg & 1;
-		if (ioreg & 4) {  // activate
-			if (hname) {
-				if (ptrfp == NULL)
-					if ((ptrfp = fopen(hname, "r")) == NULL)
-						err(1, "fopen(hname");
+		c->ptr_intr = c->ioreg & 1;
+		if (c->ioreg & 4) {  // activate
+			if (c->hname && c->playfp == NULL &&
+			    c->ptrimg == NULL) {
+				if (ptropen(c) < 0)
+					uerrx(c, "%s: %s", c->hname,
+					    strerror(errno));
+				if (c->ptr_bulk && c->recfp == NULL &&
+				    uc != NULL && c->mpc == BPUNLDR)
+					ptrbulk(c, 1);
 			}
 		}
 		break;
 
 	default:
 	//	fprintf(stderr, "ioexec %o: CAR %o ioreg %o addr %o\r\n", mpc, CAR, ioreg, CAR & 03777);
-		int14(IIE_IOX);
+		int14(c, IIE_IOX);
+	}
+	if (c->recfp && (dev == 0300 || dev == 0302 || dev == 0400 ||
+	    dev == 0402))
+		inlog(c, dev);
+	if (dev == 0300)	// after the read is logged
+		ttiset(c);
+}
+
+/*
+ * Paper tape reader.  The tape (-h) is mapped when the reader is
+ * activated and unmapped when read to the end; each status poll moves
+ * the next character to ptr_char, as the reader always is ready.
+ */
+static int
+ptropen(struct nd10 *c)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((fd = open(c->hname, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	c->ptrpos = 0;
+	if ((c->ptrlen = st.st_size) == 0) {	// never ready
+		close(fd);
+		return 0;
+	}
+	p = mmap(NULL, c->ptrlen, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	c->ptrimg = p;
+	return 0;
+}
+
+static void
+ptrclose(struct nd10 *c)
+{
+	if (c->ptrimg)
+		munmap(c->ptrimg, c->ptrlen);
+	c->ptrimg = NULL;
+	c->ptrfast = 0;
+}
+
+#define	PTRW(o)	(c->ptrimg[o] << 8 | c->ptrimg[(o)+1])
+
+/*
+ * Bulk load (-H) of a BPUN tape, see a2bpun: all words of the block
+ * but the last are put in memory here, and the tape is rewritten (in
+ * the private mapping) to be a block of only the last word, so the
+ * microcode loader reads a few characters instead of the whole tape.
+ * Only done when the loader itself starts the reader, see ioexec; a
+ * guest IOX reads the tape as it is.  The loader's checksum (D) is
+ * then left with the sum of only that word.
+ * A tape with a bad checksum is left to the microcode to complain
+ * about.  With load 0 only the tape is rewritten, for nd10_restore.
+ */
+static void
+ptrbulk(struct nd10 *c, int load)
+{
+	long d, g, l, s, i, n;
+	int addr;
+
+	if (c->ptrimg == NULL ||
+	    (d = bpunblk(c->ptrimg, c->ptrlen, &addr, &n)) < 0 || n < 2)
+		return;
+	g = d + 5;
+	if (load)
+		for (i = 0; i < n - 1; i++)
+			c->mem[(addr + i) & 0177777] = PTRW(g + 2 * i);
+	l = g + 2 * (n - 1);
+	s = l - g;		// A-D, E and F go just before the last word
+	memmove(c->ptrimg + s, c->ptrimg, d + 1);
+	addr += n - 1;
+	c->ptrimg[s + d + 1] = addr >> 8;
+	c->ptrimg[s + d + 2] = addr;
+	c->ptrimg[s + d + 3] = 0;
+	c->ptrimg[s + d + 4] = 1;
+	c->ptrimg[l + 2] = c->ptrimg[l];	// H, the sum of the last word
+	c->ptrimg[l + 3] = c->ptrimg[l + 1];
+	c->ptrpos = s;
+	c->ptrfast = 1;
+}
+
+/*
+ * The block of a BPUN tape in p: the offset of its '!', with its load
+ * address and word count, or -1 if there is none or its checksum is
+ * wrong.
+ */
+static long
+bpunblk(unsigned char *p, long len, int *addr, long *n)
+{
+	unsigned char *e;
+	unsigned short sum = 0;
+	long d, g, i;
+
+	if ((e = memchr(p, '!', len)) == NULL)
+		return -1;
+	d = e - p;
+	g = d + 5;
+	if (g > len)
+		return -1;
+	*addr = p[d+1] << 8 | p[d+2];
+	*n = p[d+3] << 8 | p[d+4];
+	if (g + 2 * *n + 2 > len)
+		return -1;
+	for (i = 0; i < *n; i++)
+		sum += p[g+2*i] << 8 | p[g+2*i+1];
+	if (sum != (p[g+2 * *n] << 8 | p[g+2 * *n+1]))
+		return -1;
+	return d;
+}
+
+/* the octal number that ends at p[e], -1 if none */
+static int
+bpunnum(unsigned char *p, long e)
+{
+	long i;
+	int v = 0;
+
+	for (i = e; i > 0 && p[i-1] >= '0' && p[i-1] <= '7'; i--)
+		;
+	if (i == e)
+		return -1;
+	while (i < e)
+		v = v * 8 + p[i++] - '0';
+	return v & 0177777;
+}
+
+/*
+ * Program loading (-l), from a.out files of nd100-as (see aout16.c
+ * there) or BPUN tapes.  The a.out words are little endian, in the
+ * order of struct exec; a program is linked to run at 0.
+ */
+#define	A_MAGIC		0407
+#define	N_ABS		1
+#define	N_BSS		4
+#define	N_EXT		040
+
+static int
+symcmp(const void *a, const void *b)
+{
+	return ((const struct ysym *)a)->y_val -
+	    ((const struct ysym *)b)->y_val;
+}
+
+/* nsym symbols at s, their names in the string table at str */
+static void
+aoutsyms(struct nd10 *c, unsigned char *p, long len, long s, long nsym,
+    long str)
+{
+	long i, o;
+	int t;
+
+	if ((c->syms = calloc(nsym, sizeof(struct ysym))) == NULL)
+		return;
+	for (i = 0; i < nsym; i++, s += 8) {
+		o = str + (p[s] | p[s+1] << 8 | p[s+2] << 16 |
+		    (long)p[s+3] << 24);
+		t = (p[s+4] | p[s+5] << 8) & ~N_EXT;
+		if (t < N_ABS || t > N_BSS || o < str || o >= len ||
+		    memchr(p + o, 0, len - o) == NULL)
+			continue;	// undefined, or debug info
+		c->syms[c->nsyms].y_val = p[s+6] | p[s+7] << 8;
+		if ((c->syms[c->nsyms].y_name = strdup((char *)p + o)) != NULL)
+			c->nsyms++;
+	}
+	qsort(c->syms, c->nsyms, sizeof(struct ysym), symcmp);
+}
+
+static int
+aoutload(struct nd10 *c, unsigned char *p, long len, int wantsyms)
+{
+#define	AW(i)	(p[2*(i)] | p[2*(i)+1] << 8)
+	long i, n, s;
+
+	n = AW(6) + AW(1) + AW(2);	// zero page, text, data
+	if (16 + 2 * n > len)
+		return -2;
+	for (i = 0; i < n; i++)
+		c->mem[i & 0177777] = AW(8 + i);
+	for (i = 0; i < AW(3); i++)	// bss
+		c->mem[(n + i) & 0177777] = 0;
+	s = 16 + 2 * n;
+	if (AW(7) == 0)			// relocation is kept
+		s += 2 * n;
+	if (wantsyms && AW(4) && s + 2 * AW(4) + 4 <= len)
+		aoutsyms(c, p, len, s, AW(4) / 4, s + 2 * AW(4));
+	return AW(5);
+#undef AW
+}
+
+/*
+ * Load a program straight into memory and set CP to its entry, which
+ * is also returned in *entry.  For a tape it is the start address the
+ * microcode loader would use, the number before the CR; -1 if there
+ * is none.  With wantsyms the symbols of an a.out are kept for the
+ * traces.
+ */
+int
+nd10_loadprog(struct nd10 *c, char *file, int wantsyms, int *entry)
+{
+	unsigned char *p;
+	struct stat st;
+	long d, i, n, e;
+	int fd, addr;
+
+	*entry = -1;
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0)
+		p = MAP_FAILED, errno = EINVAL;
+	else
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	if (st.st_size >= 16 && (p[0] | p[1] << 8) == A_MAGIC) {
+		*entry = aoutload(c, p, st.st_size, wantsyms);
+	} else if ((d = bpunblk(p, st.st_size, &addr, &n)) >= 0) {
+		for (i = 0; i < n; i++)
+			c->mem[(addr + i) & 0177777] =
+			    p[d+5+2*i] << 8 | p[d+5+2*i+1];
+		for (e = d; e > 0 && p[e-1] >= '0' && p[e-1] <= '7'; e--)
+			;		// C
+		if (e > 0 && p[e-1] == '\n')
+			e--;
+		if (e > 0 && p[e-1] == '\r')
+			*entry = bpunnum(p, e - 1);
+	} else
+		*entry = -2;
+	munmap(p, st.st_size);
+	if (*entry == -2) {
+		*entry = -1;
+		errno = EINVAL;
+		return -1;
+	}
+	if (*entry >= 0)
+		c->CP = *entry;
+	return 0;
+}
+
+/* name+offset of the symbol at or below addr, NULL if none */
+static char *
+symname(struct nd10 *c, int addr, char *buf, int len)
+{
+	int m, lo = 0, hi = c->nsyms;
+
+	while (lo < hi) {		// the first symbol above addr
+		m = (lo + hi) / 2;
+		if (c->syms[m].y_val <= addr)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+	if (lo == 0)
+		return NULL;
+	if (c->syms[lo-1].y_val == addr)
+		snprintf(buf, len, "%s", c->syms[lo-1].y_name);
+	else
+		snprintf(buf, len, "%s+%o", c->syms[lo-1].y_name,
+		    addr - c->syms[lo-1].y_val);
+	return buf;
+}
+
+/*
+ * The guest waits for input or for the clock: it has polled the console
+ * status in a short loop with nothing else happening, or it is in WAIT.
+ * If the RTC may interrupt, a turbo clock skips ahead to its next tick,
+ * but only on level 0 with no other level requested, when nothing but
+ * the tick can run; else, and with the fetch clock (where the tick needs
+ * fetches), the guest spins on.  Otherwise sleep until the console
+ * thread has input, or, paced, until the tick is due; after the end of
+ * the terminal input just sleep.  The guest cannot tell it slept.  A
+ * sleep is at most IDLEMS, so that signals are seen.
+ */
+static void
+idle(struct nd10 *c)
+{
+	struct timespec ts;
+	long ms = -1;
+
+	if (c->inton && c->rtc_doint) {
+		if (c->kmode == K_TURBO) {
+			if (c->pil == 0 && c->pkl == 0)
+				evskip(c);
+			return;
+		}
+		if (c->kmode == K_FETCH)
+			return;
+		if ((ms = (c->rtc_due - hostns()) / 1000000) <= 0)
+			return;
+	}
+	if (ms < 0 || ms > IDLEMS)
+		ms = IDLEMS;
+	if (!conon || (atomic_load(&coneof) && conlen(&conin) == 0)) {
+		// paced without a console, or no input can come
+		if (ms < IDLEMS || conon) {
+			atomic_store_explicit(&conflush, 1,
+			    memory_order_release);
+			ts.tv_sec = 0;
+			ts.tv_nsec = ms * 1000000;
+			nanosleep(&ts, NULL);
+		}
+		return;
+	}
+	atomic_store_explicit(&conflush, 1, memory_order_release);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += ms * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&conmx);
+	if (conlen(&conin) == 0 && !atomic_load(&coneof))
+		pthread_cond_timedwait(&concv, &conmx, &ts);
+	pthread_mutex_unlock(&conmx);
+}
+
+/*
+ * Is there console input to read?  Logged and replayed with -R and -P,
+ * as it decides when the guest is interrupted.
+ */
+static int
+ttiready(struct nd10 *c)
+{
+	Reg io = c->ioreg;
+	int i, r;
+
+	if (c->playfp) {
+		inplay(c, TTILINE);
+		r = c->ioreg;
+		c->ioreg = io;
+		return r;
+	}
+	if (c->ifd && (i = fgetc(c->ifd)) != EOF) {
+		ungetc(i, c->ifd);
+		r = 1;
+	} else
+		r = conon && conlen(&conin);
+	if (c->recfp) {
+		c->ioreg = r;
+		inlog(c, TTILINE);
+		c->ioreg = io;
 	}
+	return r;
+}
+
+/*
+ * Console input requests level 12 when bit 0 of its control word is
+ * set, for as long as there is input to read; looked at again after
+ * each read.  The console thread has input that arrives later looked
+ * at by the next intcalc(), or, with -R or -P, where that would not
+ * be at the same point each time, an event looks every TTIPOLL fetches.
+ */
+static void
+ttiline(struct nd10 *c)
+{
+	struct nd10 *m = c;
+
+	if (c->recfp || c->playfp) {
+		if (BIT0(c->tti_active))
+			evsched(c, ttipoll, c->icount + TTIPOLL);
+		else
+			evcancel(c, ttipoll);
+	} else if (conon && !BIT0(c->tti_active))
+		atomic_compare_exchange_strong(&conirq, &m, NULL);
+	else if (conon)
+		atomic_store(&conirq, c);
+	if (BIT0(c->tti_active) && ttiready(c))
+		c->devlines |= (1 << 12);
+	else if (c->devlines & (1 << 12))
+		intdrop(c, 12);
+}
+
+static void
+ttiset(struct nd10 *c)
+{
+	ttiline(c);
+	intcalc(c);
+}
+
+static void
+ttipoll(struct nd10 *c)
+{
+	ttiset(c);
 }
 
 void
-ident(union ucent *uc)
+ident(struct nd10 *c, struct ucdec *uc)
 {
 	int wrtioreg = 0;
 
-	switch (IR & 03) {
+	(void)uc;
+	switch (c->IR & 03) {
 	case 00: break;
 	case 01: break;
-	case 02: break;
+	case 02:
+		if (BIT0(c->tti_active) && ttiready(c))
+			wrtioreg = 1;
+		break;
 	case 03:
-		if (rtc_rft)
+		if (c->rtc_rft)
 			wrtioreg = 1;
 		break;
 	}
 	if (wrtioreg) {
-		ioreg = wrtioreg;
+		c->ioreg = wrtioreg;
 	} else
-		int14(IIE_IOX);
+		int14(c, IIE_IOX);
 }
 
 /*
  * rtc counter just reached 0.
  */
+static void
+rtctick(struct nd10 *c)
+{
+	c->rtc_rft = 1;
+	if (c->rtc_doint) {
+		c->pid |= (1 << 13);
+		intcalc(c);
+	}
+}
+
+void
+rtc_int(struct nd10 *c)
+{
+	rtctick(c);
+	rtcsched(c, c->icount + RTCTICK);
+}
+
+static long
+hostns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* paced clock, see if the tick is due */
+void
+rtc_pace(struct nd10 *c)
+{
+	long now = hostns();
+
+	if (now >= c->rtc_due) {
+		rtctick(c);
+		c->rtc_due += RTCNS;
+		if (now - c->rtc_due > 50 * RTCNS)	// stopped, do not catch up
+			c->rtc_due = now + RTCNS;
+	}
+	evsched(c, rtc_pace, c->icount + RTCPOLL);
+}
+
+/*
+ * Schedule the next RTC tick at fetch at.  When paced it is instead
+ * due as long after in host time as those fetches are in a period,
+ * and the time is looked at every RTCPOLL fetches.  Turbo is the
+ * fetch clock; cfc() skips to the tick when the guest waits.
+ */
 void
-rtc_int()
+rtcsched(struct nd10 *c, long at)
+{
+	if (c->kmode == K_PACED) {
+		c->rtc_due = hostns() + (at - c->icount) * (RTCNS / RTCTICK);
+		evsched(c, rtc_pace, c->icount + RTCPOLL);
+	} else
+		evsched(c, rtc_int, at);
+}
+
+/* fetches left to the next tick */
+long
+rtcleft(struct nd10 *c)
 {
-	rtc_rft = 1;
-	if (rtc_doint)
-		pid |= (1 << 13);
+	if (c->kmode == K_PACED)
+		return (c->rtc_due - hostns()) / (RTCNS / RTCTICK);
+	return evwhen(c, rtc_int) - c->icount;
 }
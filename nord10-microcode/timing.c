@@ -47,7 +47,7 @@ int MIR[32], MIR_n[32];
 int SIR9, CPDEST, DBL, DDBL_n;
 
 int
-main(int argc, char *argv[])
+main(void)
 {
 	int i;
 	int x_2a2 = 0, x_2a7 = 0, x_2a10 = 0;
@@ -96,7 +96,7 @@ main(int argc, char *argv[])
 void
 dblupdate()
 {
-	int x_16c6, AT3_n;
+	int x_16c6 = 1, AT3_n;
 	static int last_T1_n, last_AT3_n;	// Last timing states (for rising edge)
 	static int last_14c5_Q, last_14c9_Q;	// last output Q (D ff states)
 	int last_14c5_Qn;
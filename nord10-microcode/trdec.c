@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024 Anders Magnusson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Print a binary microcode trace from nd10uc -t as text, one line
+ * per micro-step.
+ */
+
+#include <err.h>
+#include <stdio.h>
+
+#include "utrace.h"
+
+char *anames[] = { "ZZ", " D", " P", " B", " L", " A", " T", " X",
+	" S", "DH", "XX", " H", "SR", " R", "SP", "SS" };
+char *dnames[] = { "ZZ", " D", " P", " B", " L", " A", " T", " X",
+	" S", "SH", "XX", "SC", "SR", "YY", "SP", "SS" };
+
+#define	NXIOX	1024
+
+int
+main(int argc, char *argv[])
+{
+	struct trrec t;
+	unsigned short xiox[NXIOX];
+	int i, nx = 0;
+	FILE *fp = stdin;
+
+	if (argc > 2)
+		errx(1, "usage: %s [tracefile]", argv[0]);
+	if (argc == 2 && (fp = fopen(argv[1], "r")) == NULL)
+		err(1, "%s", argv[1]);
+
+	while (fread(&t, sizeof(t), 1, fp) == 1) {
+		if (t.t_flags & TR_XIOX) {	// printed with its step
+			if (nx < NXIOX)
+				xiox[nx++] = t.t_iox;
+			continue;
+		}
+		printf("%04o: %08X", t.t_mpc, t.t_line);
+		if (t.t_flags & TR_A)
+			printf(" %s%02o(A)=%06o", anames[t.t_areg & 017],
+			    t.t_alvl, t.t_aval);
+		if ((t.t_flags & (TR_IOX|TR_IOXC)) == TR_IOX)
+			printf(" iox %o", t.t_iox);
+		if (t.t_flags & TR_B)
+			printf(" B=%06o", t.t_bval);
+		if (t.t_flags & TR_D)
+			printf(": D=%06o in %s%02o", t.t_dval,
+			    dnames[t.t_dreg & 017], t.t_dlvl);
+		if (t.t_flags & TR_CYC)
+			printf(" cycle in adr %o ", t.t_cadr);
+		if (t.t_flags & TR_IOXC) {
+			printf(" iox %o", t.t_iox);
+			for (i = 0; i < nx; i++)
+				printf(" iox %o", xiox[i]);
+		}
+		nx = 0;
+		if (t.t_flags & TR_CYC)
+			printf(" cycle %o R=%o adr %o ", t.t_cycle, t.t_R,
+			    t.t_cadr2);
+		if (t.t_flags & TR_JMP)
+			printf(" %sJMP to %o", t.t_flags & TR_CJMP ? "C" : "",
+			    t.t_jmp);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2024 Anders Magnusson.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Binary microcode trace written by nd10uc -t, one record per
+ * micro-step.  The flags tell which parts of it were done; trdec
+ * prints it as text.
+ */
+
+#define	TR_A	0001	/* A operand read, t_areg, t_alvl, t_aval */
+#define	TR_B	0002	/* B operand read, t_bval */
+#define	TR_D	0004	/* destination written, t_dreg, t_dlvl, t_dval */
+#define	TR_CYC	0010	/* memory cycle, t_cycle, t_cadr, t_cadr2 */
+#define	TR_JMP	0020	/* jump to t_jmp */
+#define	TR_CJMP	0040	/* the jump was conditional */
+#define	TR_IOX	0100	/* IOX t_iox done */
+#define	TR_IOXC	0200	/* ... in the memory cycle */
+#define	TR_XIOX	0400	/* not a step, another IOX in the step after it */
+
+struct trrec {
+	unsigned int t_line;	/* the microword */
+	unsigned int t_aval, t_bval, t_dval;
+	unsigned short t_mpc;
+	unsigned short t_flags;
+	unsigned short t_R, t_H;	/* after the step */
+	unsigned short t_cadr, t_cadr2;	/* mem[052744] before and after */
+	unsigned short t_jmp, t_iox;
+	unsigned char t_areg, t_alvl, t_dreg, t_dlvl;
+	unsigned char t_cycle, t_pad[3];
+};